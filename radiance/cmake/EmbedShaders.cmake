@@ -0,0 +1,67 @@
+# Generates a C++ source holding OpenCL sources as a table of string literals.
+#
+# Script mode, run at build time by radiance_embed_shaders():
+#   cmake -DOUTPUT=<file.cpp> -DTABLE=<name> [-DNAMESPACE=<ns>] -DINPUTS=<a.cl|b.cl> -P EmbedShaders.cmake
+#
+# Entries are keyed by file name, the table ends with {nullptr, nullptr}.
+
+if(CMAKE_SCRIPT_MODE_FILE)
+
+string(REPLACE "|" ";" INPUTS "${INPUTS}")
+
+set(content "// Generated by EmbedShaders.cmake, do not edit.\n")
+string(APPEND content "#include \"shaderlib.h\"\n\n")
+if(NAMESPACE)
+    string(APPEND content "namespace ${NAMESPACE}\n{\n\n")
+endif()
+
+string(APPEND content "extern const RD::EmbeddedShader ${TABLE}[] = {\n")
+foreach(input ${INPUTS})
+    get_filename_component(name ${input} NAME)
+    file(READ ${input} source)
+    string(APPEND content "{\"${name}\", R\"RDSHADER(${source})RDSHADER\"},\n")
+endforeach()
+string(APPEND content "{nullptr, nullptr}\n};\n")
+
+if(NAMESPACE)
+    string(APPEND content "\n} // namespace ${NAMESPACE}\n")
+endif()
+
+# Leave the output untouched when nothing changed, so dependents are not rebuilt
+if(EXISTS ${OUTPUT})
+    file(READ ${OUTPUT} previous)
+endif()
+if(NOT "${previous}" STREQUAL "${content}")
+    file(WRITE ${OUTPUT} "${content}")
+endif()
+
+else()
+
+set(RADIANCE_EMBED_SHADERS_SCRIPT ${CMAKE_CURRENT_LIST_FILE} CACHE INTERNAL "")
+
+# radiance_embed_shaders(<output.cpp> <table> [NAMESPACE <ns>] FILES <a.cl> ...)
+function(radiance_embed_shaders OUTPUT TABLE)
+    cmake_parse_arguments(EMBED "" "NAMESPACE" "FILES" ${ARGN})
+
+    set(inputs)
+    foreach(file ${EMBED_FILES})
+        get_filename_component(path ${file} ABSOLUTE)
+        list(APPEND inputs ${path})
+    endforeach()
+    string(REPLACE ";" "|" inputList "${inputs}")
+
+    add_custom_command(
+        OUTPUT ${OUTPUT}
+        COMMAND ${CMAKE_COMMAND}
+            -DOUTPUT=${OUTPUT}
+            -DTABLE=${TABLE}
+            -DNAMESPACE=${EMBED_NAMESPACE}
+            -DINPUTS=${inputList}
+            -P ${RADIANCE_EMBED_SHADERS_SCRIPT}
+        DEPENDS ${inputs} ${RADIANCE_EMBED_SHADERS_SCRIPT}
+        COMMENT "Embedding shaders into ${TABLE}"
+        VERBATIM
+    )
+endfunction()
+
+endif()
@@ -3,8 +3,7 @@
 
 #include "core.h"
 #include "clcontext.h"
-
-#define SHADER_LIB_PATH "/home/zekailin00/Desktop/ray-tracing/framework/radiance/shader"
+#include "shaderlib.h"
 
 namespace RD
 {
@@ -35,6 +34,21 @@ struct Mesh
     std::vector<Triangle> indexData;
 };
 
+// Borrowed host mesh data, e.g. the range of one mesh in a scene wide array
+struct MeshView
+{
+    const Vec3* vertexData;
+    size_t vertexCount;
+    const Triangle* indexData;
+    size_t indexCount;
+
+    // With a stride set, the bottom level AS keeps no copy of the positions and traversal
+    // reads them from the vertex buffer passed to traceRay(), vertex i at float
+    // vertexBufferOffset + i * vertexBufferStride. vertexData must hold the same positions.
+    unsigned int vertexBufferOffset = 0;
+    unsigned int vertexBufferStride = 0;
+};
+
 struct BVHNode;
 struct _BottomAccelStruct
 {
@@ -55,41 +69,104 @@ struct Instance
 };
 
 typedef std::vector<Handle> DescriptorSet;
-typedef std::vector<DescriptorType> PipelineLayout;
 
-typedef cl_kernel ShaderModule;
+// Push constants are small blocks of data passed by value as kernel arguments
+// after the descriptors, one argument per range: no buffer, no transfer.
+struct PipelineLayout
+{
+    std::vector<DescriptorType> descriptorTypes;
+    std::vector<unsigned int>   pushConstantSizes; // size in bytes of each range
+};
+
+enum ShaderStage
+{
+    RAYGEN_STAGE,       // __kernel void name(...)
+    MISS_STAGE,         // void name(payload, sceneData, imageArray, sampler)
+    CLOSEST_HIT_STAGE,  // void name(payload, hitData, sceneData, imageArray, sampler)
+    ANY_HIT_STAGE       // void name(cont, payload, hitData, sceneData, imageArray, sampler)
+};
+
+// Shader source and entry point name, compiled when a pipeline using it is created.
+// Modules sharing the same source are compiled once.
+struct _ShaderModule;
+typedef _ShaderModule* ShaderModule;
 
+// Shader binding table record, indices into PipelineCreateInfo::modules.
+// The group index is the SBT index: callHit/callMiss/callAnyHit are generated
+// from the groups, hit groups are selected with instance SBT offset + sbtRecordOffset
+// and miss groups with missIndex in traceRay().
 #define SHADER_UNUSED (~0U)
 struct ShaderGroup
 {
-    ShaderModule generalShader; // from Vulkan. Either miss or raygen
-    ShaderModule closestHitShader;
-    ShaderModule anyHitShader; // TODO: names of the shader functions 
-    //ShaderModule intersectionShader; // No intersection shader. triangles only
+    unsigned int generalShader; // from Vulkan. Either miss or raygen
+    unsigned int closestHitShader;
+    unsigned int anyHitShader;
+    //unsigned int intersectionShader; // No intersection shader. triangles only
 };
 
+// Defined as a macro when compiling the pipeline, e.g. -DSPEC_MAX_DEPTH=4.
+// Lets the compiler fold constants, unroll loops and drop unused paths.
+struct SpecializationConstant
+{
+    std::string name;
+    int value;
+};
+
+typedef uint32_t CompileFlags;
+// - Generate debug information (-g).
+#define RD_COMPILE_DEBUG_INFO      0x1
+// - Allow a * b + c to be computed with reduced accuracy (-cl-mad-enable).
+#define RD_COMPILE_MAD_ENABLE      0x2
+// - Allow optimizations that assume no infs or NaNs (-cl-fast-relaxed-math).
+//   Ray/box slab tests rely on inf for axis aligned rays, use with care.
+#define RD_COMPILE_FAST_MATH       0x4
+
 struct PipelineCreateInfo
 {
     unsigned int                maxRayRecursionDepth;
     PipelineLayout              layout;
 
     std::vector<ShaderModule>   modules;
-    std::vector<ShaderGroup>    groups;
+    std::vector<ShaderGroup>    groups; // empty: shader defines "raygen" and the call functions
+
+    std::vector<SpecializationConstant> constants;
+    CompileFlags                compileFlags = RD_COMPILE_DEBUG_INFO;
 };
 
-typedef PipelineCreateInfo Pipeline;
+struct _Pipeline;
+typedef _Pipeline* Pipeline;
 
 struct Platform;
 
 #define CHANNEL 4
 #define RD_CHANNEL CHANNEL
 
+// TraceRays launches a 2D NDRange padded to whole tiles of RD_TILE_DIM^2 pixels.
+// Must match LAUNCH_TILE_DIM in shader/launch.cl.
+#define RD_TILE_DIM 8
+
 // blocking, build AS
+// Bottom level AS are cached on disk keyed by mesh content and builder settings,
+// a cache hit skips the build and leaves root as nullptr.
+// Thread safe, bottom level AS of different meshes can be built concurrently.
 BottomAccelStruct BuildAccelStruct(Platform* platform, Mesh& mesh);
+BottomAccelStruct BuildAccelStruct(Platform* platform, const MeshView& mesh);
 TopAccelStruct BuildAccelStruct(Platform* platform, std::vector<Instance>& instances);
 
-void TopAccelStructToFile(Platform* platform, TopAccelStruct accelStruct, const char* path);
-void FileToTopAccelStruct(Platform* platform, const char* path, TopAccelStruct* accelStruct);
+// Optional pass before the top level build: renumbers the triangles of a bottom level AS
+// in leaf order and its vertices in order of first use by them, so hit attribute fetches
+// follow traversal. New triangle i was faceOrder[i] and new vertex i was vertexOrder[i],
+// traversal reports the new triangle indices. Embedded positions are permuted here,
+// the caller permutes its index, attribute and external vertex arrays the same way.
+void ReorderAccelStructMesh(BottomAccelStruct accelStruct, size_t vertexCount,
+    std::vector<unsigned int>& faceOrder, std::vector<unsigned int>& vertexOrder);
+
+// Streamed in chunks, the whole AS is never held in host memory.
+// Loading returns false when the file is missing, stale or corrupt.
+bool TopAccelStructToFile(Platform* platform, TopAccelStruct accelStruct, const char* path);
+bool FileToTopAccelStruct(Platform* platform, const char* path, TopAccelStruct* accelStruct);
+// Self contained blob of a top level AS, upload it to a buffer of the same size to restore it
+void ReadTopAccelStruct(Platform* platform, TopAccelStruct accelStruct, std::vector<char>& data);
 
 typedef uint32_t AddressingMode;
 // - Out-of-range image coordinates are clamped to the edge of the image.
@@ -111,9 +188,95 @@ typedef uint32_t FilterMode;
 //    nearest to the image coordinate.
 #define RD_FILTER_LINEAR           CL_FILTER_LINEAR
 
+typedef uint32_t MemoryFlags;
+// - Device local memory, host access with ReadBuffer/WriteBuffer copies.
+#define RD_MEMORY_DEVICE           0
+// - Driver allocated host accessible memory (CL_MEM_ALLOC_HOST_PTR).
+//   On unified memory devices MapBuffer() returns it without a copy.
+#define RD_MEMORY_HOST_ALLOC       1
+// - Wraps caller owned host memory (CL_MEM_USE_HOST_PTR).
+//   The memory must outlive the buffer, align it to 4096 bytes for zero-copy.
+#define RD_MEMORY_HOST_PTR         2
+
+typedef uint32_t MapAccess;
+// - Host reads the mapped region.
+#define RD_MAP_READ                CL_MAP_READ
+// - Host writes the mapped region, existing contents are preserved.
+#define RD_MAP_WRITE               CL_MAP_WRITE
+// - Host overwrites the whole mapped region, existing contents are undefined.
+#define RD_MAP_WRITE_DISCARD       CL_MAP_WRITE_INVALIDATE_REGION
+
+
+// Texture tables (TextureInfo in core.h): native size textures with mip chains
+// in one buffer, sampled with shader/texture.cl. Mips are 2x2 box filtered.
+struct TextureDesc
+{
+    unsigned int format = TEXTURE_FORMAT_RGBA8;
+    unsigned int swizzle = TEXTURE_SWIZZLE_RGBA;
+    unsigned int layout = TEXTURE_LAYOUT_LINEAR;
+    AddressingMode addressMode = RD_ADDRESS_REPEAT;
+    FilterMode filterMode = RD_FILTER_LINEAR;
+};
 
-Buffer CreateBuffer(Platform* platform, unsigned int size);
-Image CreateImage(Platform* platform, unsigned int width, unsigned int height);
+unsigned int TextureLevelCount(unsigned int width, unsigned int height);
+void BuildMipChain(unsigned int width, unsigned int height,
+    const unsigned char* rgba, std::vector<unsigned char>& levels); // level 0 first
+// Block formats and the layout are encoded here from the RGBA8 levels.
+// Returns the index of the new entry, the table is limited to 4 GB (32-bit offsets).
+unsigned int AppendTexture(std::vector<TextureInfo>& infos, std::vector<unsigned char>& data,
+    unsigned int width, unsigned int height, const std::vector<unsigned char>& levels,
+    const TextureDesc& desc = TextureDesc());
+// Layout suited to the device, Morton order where texture reads go through the CPU caches
+unsigned int PreferredTextureLayout(Platform* platform);
+
+// Virtual texturing for texture tables larger than device memory.
+// The texel buffer is split in TEXTURE_PAGE_SIZE pages, resident pages live in a fixed
+// pool and a page table maps them (texture.cl built with TEXTURE_VIRTUAL=1). Kernels mark
+// the pages they sample in a feedback buffer and fall back to coarser levels on a miss.
+// UpdateVirtualTexture() streams the missing pages in between trace batches, evicting the
+// least recently used. Pages holding the last level of a texture stay resident.
+#define RD_VIRTUAL_TEXTURE_MAX_PAGES 64 // per update, bounds the stall between batches
+
+struct _VirtualTexture;
+typedef _VirtualTexture* VirtualTexture;
+
+// Texels are read in place until the virtual texture is destroyed, e.g. from a file mapping
+VirtualTexture CreateVirtualTexture(Platform* platform, const std::vector<TextureInfo>& infos,
+    const void* texels, size_t size, size_t poolSize);
+void DestroyVirtualTexture(VirtualTexture texture);
+// Reads and clears the feedback, returns the number of pages streamed in.
+// No kernel may run on the buffers meanwhile.
+unsigned int UpdateVirtualTexture(VirtualTexture texture,
+    unsigned int maxPages = RD_VIRTUAL_TEXTURE_MAX_PAGES);
+Buffer VirtualTexturePool(VirtualTexture texture);      // bound as the texel buffer
+Buffer VirtualTexturePageTable(VirtualTexture texture); // uint per page, TEXTURE_PAGE_NONE if missing
+Buffer VirtualTextureFeedback(VirtualTexture texture);  // uint per page, TEXTURE_FEEDBACK_*
+
+// Packed shading attributes (indices, UVs and normals) of meshes, appended one mesh
+// at a time and decoded with shader/attribute.cl. Formats are chosen per mesh.
+struct AttributeDesc
+{
+    unsigned int indexFormat = ATTRIBUTE_INDEX_UINT16;   // UINT32 for larger meshes
+    unsigned int uvFormat = ATTRIBUTE_UV_HALF2;         // FLOAT2 when over uvTolerance
+    unsigned int normalFormat = ATTRIBUTE_NORMAL_OCT32;
+    float uvTolerance = 1.0f / 4096.0f; // largest UV error allowed, e.g. half a texel
+};
+
+struct AttributeStreams
+{
+    std::vector<uint32_t> indexData;
+    std::vector<uint32_t> uvData;
+    std::vector<uint32_t> normalData;
+};
+
+// Sets the attribute offsets and formats of meshInfo, uvs and normals are per vertex
+void AppendMeshAttributes(AttributeStreams& streams, MeshInfo& meshInfo, const MeshView& mesh,
+    const Vec3* uvs, const Vec3* normals, const AttributeDesc& desc = AttributeDesc());
+
+Buffer CreateBuffer(Platform* platform, size_t size,
+    MemoryFlags flags = RD_MEMORY_DEVICE, void* hostPtr = nullptr);
+Image CreateImage(Platform* platform, unsigned int width, unsigned int height,
+    MemoryFlags flags = RD_MEMORY_DEVICE, void* hostPtr = nullptr);
 ImageArray CreateImageArray(Platform* platform, unsigned int width, unsigned int height, unsigned int arraySize);
 Sampler CreateSampler(Platform* platform, AddressingMode addressingMode, FilterMode filterMode);
 
@@ -127,13 +290,57 @@ void ReadBuffer(Platform* platform, Buffer handle,
 void WriteBuffer(Platform* platform, Buffer handle,
     size_t size, void* data, size_t offset = 0);
 
+// Blocking. The mapped region must be unmapped before the buffer is used by a kernel.
+// Zero-copy for RD_MEMORY_HOST_ALLOC and RD_MEMORY_HOST_PTR buffers on unified memory devices.
+void* MapBuffer(Platform* platform, Buffer handle,
+    size_t size, MapAccess access, size_t offset = 0);
+void UnmapBuffer(Platform* platform, Buffer handle, void* mapped);
+bool HasUnifiedMemory(Platform* platform); // device shares physical memory with host
+
+// Batched non-blocking uploads through a pinned staging ring buffer (CL_MEM_ALLOC_HOST_PTR).
+// Source data is copied into the ring right away and can be freed after the call returns.
+// Transfers are only guaranteed to be complete after FlushUploads().
+// On unified memory devices buffer uploads are written in place through a mapping instead,
+// the ring is only allocated once an upload goes through it.
+#define RD_STAGING_RING_SIZE (64u << 20)
+
+struct _UploadManager;
+typedef _UploadManager* UploadManager;
+
+UploadManager CreateUploadManager(Platform* platform, size_t ringSize = RD_STAGING_RING_SIZE);
+void DestroyUploadManager(UploadManager uploader); // flushes pending uploads
+void UploadBuffer(UploadManager uploader, Buffer handle,
+    size_t size, const void* data, size_t offset = 0);
+void UploadImage(UploadManager uploader, ImageArray handle,
+    unsigned int width, unsigned int height, size_t arrayIndex, const void* data);
+void FlushUploads(UploadManager uploader); // sync point, waits for all transfers
+
 DescriptorSet   CreateDescriptorSet(std::vector<Handle> handles); // allocate GPU resources
-PipelineLayout  CreatePipelineLayout(std::vector<DescriptorType> descriptorTypes);
-ShaderModule    CreateShaderModule(Platform* platform, char* code, unsigned int size, char* name);
-Pipeline        CreatePipeline(PipelineCreateInfo pipelineCreateInfo); // upload shader code to GPU
+PipelineLayout  CreatePipelineLayout(std::vector<DescriptorType> descriptorTypes,
+                    std::vector<unsigned int> pushConstantSizes = {});
+ShaderModule    CreateShaderModule(Platform* platform, const char* code, unsigned int size,
+                    const char* name, ShaderStage stage = RAYGEN_STAGE);
+Pipeline        CreatePipeline(Platform* platform, PipelineCreateInfo pipelineCreateInfo); // compile shader code
+
+// Switch the pipeline to the variant compiled with the given constants.
+// Variants are compiled on first use and kept until the pipeline is destroyed.
+// The descriptor set bound to the pipeline is bound to the new variant as well.
+void SpecializePipeline(Pipeline pipeline, const std::vector<SpecializationConstant>& constants);
+// Start compiling a variant in the background, e.g. once the scene decides the constants.
+// The pipeline keeps its active variant, WaitForPipeline() also waits for these builds.
+void SpecializePipelineAsync(Pipeline pipeline, const std::vector<SpecializationConstant>& constants);
+void DestroyPipeline(Pipeline pipeline);
+
+// Compile on a background thread and return right away, so the build overlaps
+// asset loading. Binding or tracing with the pipeline waits for the build.
+Pipeline        CreatePipelineAsync(Platform* platform, PipelineCreateInfo pipelineCreateInfo);
+void            WaitForPipeline(Pipeline pipeline);
+void DestroyShaderModule(ShaderModule shaderModule);
 
 void BindPipeline(Platform* platform, Pipeline pipeline);
 void BindDescriptorSet(Platform* platform, DescriptorSet descriptorSet);
+// Data is captured right away, size must match the range in the pipeline layout.
+void PushConstants(Platform* platform, unsigned int rangeIndex, unsigned int size, const void* data);
 
 void TraceRays(Platform* platform,
     unsigned int raygenGroupIndex,
@@ -143,6 +350,45 @@ void TraceRays(Platform* platform,
     unsigned int height
 );
 
+// Asynchronous command recording.
+// Commands recorded into a command buffer run in recorded order once submitted,
+// chained with cl_event dependencies, without blocking the host.
+// Separate submissions are independent unless ordered with wait fences.
+// Host memory passed to CmdWriteBuffer/CmdWriteImage/CmdReadBuffer must stay valid
+// until the fence returned by SubmitCommandBuffer is signaled.
+struct _CommandBuffer;
+typedef _CommandBuffer* CommandBuffer;
+typedef cl_event Fence;
+
+CommandBuffer CreateCommandBuffer(Platform* platform);
+void DestroyCommandBuffer(CommandBuffer commandBuffer);
+void ResetCommandBuffer(CommandBuffer commandBuffer); // clear recorded commands
+
+void CmdWriteBuffer(CommandBuffer commandBuffer, Buffer handle,
+    size_t size, void* data, size_t offset = 0);
+void CmdReadBuffer(CommandBuffer commandBuffer, Buffer handle,
+    size_t size, void* data, size_t offset = 0);
+void CmdWriteImage(CommandBuffer commandBuffer, ImageArray handle,
+    unsigned int width, unsigned int height, size_t arrayIndex, void* data);
+void CmdBindPipeline(CommandBuffer commandBuffer, Pipeline pipeline);
+void CmdBindDescriptorSet(CommandBuffer commandBuffer, DescriptorSet descriptorSet);
+void CmdPushConstants(CommandBuffer commandBuffer, // data is copied at record time
+    unsigned int rangeIndex, unsigned int size, const void* data);
+void CmdTraceRays(CommandBuffer commandBuffer,
+    unsigned int raygenGroupIndex,
+    unsigned int missGroupIndex,
+    unsigned int hitGroupIndex,
+    unsigned int width,
+    unsigned int height
+);
+
+// Returned fence is owned by the caller, release it with DestroyFence().
+Fence SubmitCommandBuffer(Platform* platform, CommandBuffer commandBuffer,
+    const std::vector<Fence>& waitFences = {});
+bool GetFenceStatus(Platform* platform, Fence fence); // true if signaled
+void WaitForFence(Platform* platform, Fence fence);
+void DestroyFence(Fence fence);
+
 struct Platform
 {
     static Platform* GetPlatform()
@@ -163,7 +409,7 @@ struct Platform
         clContext->Cleanup();
     }
 
-    Pipeline activePipeline;
+    Pipeline activePipeline = nullptr;
     CLContext* clContext = nullptr;
     bool initialized = false;
 
@@ -0,0 +1,20 @@
+#pragma once
+
+namespace RD
+{
+
+// OpenCL source compiled into the binary, see radiance/cmake/EmbedShaders.cmake.
+// Tables end with {nullptr, nullptr}.
+struct EmbeddedShader
+{
+    const char* name; // file name, e.g. "radiance.cl"
+    const char* source;
+};
+
+// radiance/shader/*.cl, resolves #include "..." in pipeline sources
+extern const EmbeddedShader shaderLibrary[];
+
+// Source of the entry called `name`, nullptr if there is none
+const char* FindEmbeddedShader(const EmbeddedShader* table, const char* name);
+
+} // namespace RD
@@ -0,0 +1,64 @@
+#ifndef ATTRIBUTE_CL
+#define ATTRIBUTE_CL
+
+#include "pbr.cl"
+
+// Packed shading attributes, see AppendMeshAttributes() in radiance.h.
+//
+// Every stream is an array of 32-bit words and MeshInfo holds the offset of a mesh
+// in each of them, in words, along with the format of each stream:
+// - indices: 3 per triangle as uint, or as ushort packed in pairs (low half first)
+// - UVs: 2 floats per vertex, or one word of two halfs (u low)
+// - normals: 3 floats per vertex, or one octahedral word of two snorm16 (x low)
+
+#define ATTRIBUTE_INDEX_UINT32  0
+#define ATTRIBUTE_INDEX_UINT16  1
+#define ATTRIBUTE_UV_FLOAT2     0
+#define ATTRIBUTE_UV_HALF2      1
+#define ATTRIBUTE_NORMAL_FLOAT3 0
+#define ATTRIBUTE_NORMAL_OCT32  1
+
+inline float3 octDecode(uint packed)
+{
+    float2 e = max((float2)((short)(packed & 0xffff), (short)(packed >> 16)) / 32767.0f, -1.0f);
+    float3 n = {e.x, e.y, 1.0f - fabs(e.x) - fabs(e.y)};
+    if (n.z < 0.0f)
+    {
+        float2 folded = (1.0f - fabs(e.yx)) * select((float2)(-1.0f), (float2)(1.0f), e >= 0.0f);
+        n.xy = folded;
+    }
+    return normalize(n);
+}
+
+inline uint3 attributeIndices(__global const uint* indexData,
+    __global const struct MeshInfo* meshInfo, uint primitiveIndex)
+{
+    __global const uint* mesh = indexData + meshInfo->indexOffset;
+    if (meshInfo->indexFormat == ATTRIBUTE_INDEX_UINT16)
+    {
+        __global const ushort* mesh16 = (__global const ushort*)mesh;
+        return convert_uint3(vload3(primitiveIndex, mesh16));
+    }
+    return vload3(primitiveIndex, mesh);
+}
+
+inline float2 attributeUV(__global const uint* uvData,
+    __global const struct MeshInfo* meshInfo, uint vertex)
+{
+    __global const uint* mesh = uvData + meshInfo->uvOffset;
+    if (meshInfo->uvFormat == ATTRIBUTE_UV_HALF2)
+        return vload_half2(vertex, (__global const half*)mesh);
+    return as_float2(vload2(vertex, mesh));
+}
+
+// Not normalized for FLOAT3, as stored
+inline float3 attributeNormal(__global const uint* normalData,
+    __global const struct MeshInfo* meshInfo, uint vertex)
+{
+    __global const uint* mesh = normalData + meshInfo->normalOffset;
+    if (meshInfo->normalFormat == ATTRIBUTE_NORMAL_OCT32)
+        return octDecode(mesh[vertex]);
+    return as_float3(vload3(vertex, mesh));
+}
+
+#endif // ATTRIBUTE_CL
@@ -0,0 +1,92 @@
+#ifndef BCN_CL
+#define BCN_CL
+
+// Block compressed texel decode, one texel of a 4x4 block per call.
+// Texel <x, y> is texel (y % 4) * 4 + x % 4 of block <x / 4, y / 4>,
+// the block order is up to the texture layout (textureElementIndex()).
+//
+// BC1: two RGB565 endpoints, 2 bit indices. c0 > c1 selects 4 colors,
+//      otherwise 3 colors and transparent black.
+// BC4: two 8 bit endpoints, 3 bit indices. r0 > r1 selects 8 values,
+//      otherwise 6 values, 0 and 1.
+// BC5: two BC4 blocks, red then green.
+
+inline uint bcTexelIndex(int x, int y)
+{
+    return ((y & 3) << 2) | (x & 3);
+}
+
+inline float3 bc1Color(uint c)
+{
+    uint3 bits = {(c >> 11) & 31, (c >> 5) & 63, c & 31};
+    float3 scale = {1.0f / 31.0f, 1.0f / 63.0f, 1.0f / 31.0f};
+    return convert_float3(bits) * scale;
+}
+
+float4 bc1Decode(uint2 block, uint texel)
+{
+    uint c0 = block.x & 0xffff;
+    uint c1 = block.x >> 16;
+    float3 e0 = bc1Color(c0);
+    float3 e1 = bc1Color(c1);
+
+    float4 color = {0.0f, 0.0f, 0.0f, 1.0f};
+    switch ((block.y >> (2 * texel)) & 3)
+    {
+    case 0: color.xyz = e0; break;
+    case 1: color.xyz = e1; break;
+    case 2: color.xyz = c0 > c1 ? (2.0f * e0 + e1) / 3.0f : (e0 + e1) * 0.5f; break;
+    case 3:
+        if (c0 > c1)
+            color.xyz = (e0 + 2.0f * e1) / 3.0f;
+        else
+            color.w = 0.0f;
+        break;
+    }
+    return color;
+}
+
+float bc4Decode(uint2 block, uint texel)
+{
+    float r0 = (float)(block.x & 0xff);
+    float r1 = (float)((block.x >> 8) & 0xff);
+
+    // 3 bit indices start at bit 16 and straddle the two words
+    ulong bits = (ulong)block.x | ((ulong)block.y << 32);
+    uint index = (uint)(bits >> (16 + 3 * texel)) & 7;
+
+    float value;
+    if (index == 0)
+        value = r0;
+    else if (index == 1)
+        value = r1;
+    else if (r0 > r1)
+        value = ((8 - index) * r0 + (index - 1) * r1) / 7.0f;
+    else if (index < 6)
+        value = ((6 - index) * r0 + (index - 1) * r1) / 5.0f;
+    else
+        value = index == 6 ? 0.0f : 255.0f;
+    return value * (1.0f / 255.0f);
+}
+
+inline float4 bc1Texel(__global const uchar* blockData, uint texel)
+{
+    uint2 block = vload2(0, (__global const uint*)blockData);
+    return bc1Decode(block, texel);
+}
+
+inline float4 bc4Texel(__global const uchar* blockData, uint texel)
+{
+    uint2 block = vload2(0, (__global const uint*)blockData);
+    float4 color = {bc4Decode(block, texel), 0.0f, 0.0f, 1.0f};
+    return color;
+}
+
+inline float4 bc5Texel(__global const uchar* blockData, uint texel)
+{
+    uint4 block = vload4(0, (__global const uint*)blockData);
+    float4 color = {bc4Decode(block.xy, texel), bc4Decode(block.zw, texel), 0.0f, 1.0f};
+    return color;
+}
+
+#endif
@@ -9,12 +9,15 @@ struct AccelStructTop // 1 block
     unsigned int totalBufferSize;
 };
 
-struct AccelStructBottom // 1 block
+struct AccelStructBottom // 2 blocks
 {
     unsigned int type;
     unsigned int nodeByteOffset;
     unsigned int faceByteOffset;
-    unsigned int vertexOffset;
+    unsigned int vertexOffset;   // bytes from the header, or floats into the external vertex buffer
+    unsigned int vertexStride;   // floats from one vertex to the next
+    unsigned int vertexExternal; // positions are read from the vertex buffer given to traceRay()
+    unsigned int _0, _1;
 };
 
 struct AccelStruct// 1 block
@@ -31,6 +34,8 @@ struct AccelStruct// 1 block
         struct {
             unsigned int faceByteOffset;
             unsigned int vertexOffset;
+            unsigned int vertexStride;
+            unsigned int vertexExternal;
         } bot;
     } u;
 };
@@ -91,6 +96,8 @@ typedef float4 Vertex; // 1 block
 
 #define TO_BVH_NODE(accelStruct) (__global struct BVHNode*)(((__global char*)accelStruct) + accelStruct->nodeByteOffset)
 #define TO_VERTEX(accelStruct)   (__global Vertex*)(((__global char*)accelStruct) + accelStruct->u.bot.vertexOffset)
+#define TO_POSITION(accelStruct, vertexData) (accelStruct->u.bot.vertexExternal ? \
+    (vertexData) + accelStruct->u.bot.vertexOffset : (__global const float*)TO_VERTEX(accelStruct))
 #define TO_FACE(accelStruct)     (__global struct Triangle*)(((__global char*)accelStruct) + accelStruct->u.bot.faceByteOffset)
 #define TO_INST(accelStruct)     (__global struct Instance*)(((__global char*)accelStruct) + accelStruct->u.top.instByteOffset)
 #define TO_BOT_AS(topAS, inst)   (__global struct AccelStruct*)(((__global char*)topAS) + inst->instanceOffset)
@@ -252,10 +259,11 @@ Top level layout:
 
 Bottom level layout:
 +--------+--------+--------+--------+--------+--------+--------+--------+--------+--------+
-| ASBotH |@        BVH Node         |         BVH Node         |         BVH Node         |
+|     ASBotH      |@        BVH Node         |         BVH Node         |   BVH Node ...  |
 +--------+--------+--------+--------+--------+--------+--------+--------+--------+--------+
 |@ Trig  |  Trig  |  Trig  |  Trig  |  Trig  |  Trig  |@ Vert  |  Vert  |  Vert  |  Vert  |
 +--------+--------+--------+--------+--------+--------+--------+--------+--------+--------+
+Vertices are left out when the bottom level AS reads an external vertex buffer.
 
 
 Example:
@@ -0,0 +1,62 @@
+#ifndef LAUNCH_CL
+#define LAUNCH_CL
+
+// Launch layout used by TraceRays. Must match RD_TILE_DIM in radiance.h.
+//
+// The NDRange is two dimensional and rounded up to whole tiles. Inside each
+// LAUNCH_TILE_DIM x LAUNCH_TILE_DIM tile, the row-major work item index is
+// remapped to Morton (Z) order, so work items that run next to each other
+// trace rays through neighbouring pixels and touch the same BVH nodes.
+//
+//  row-major index        Morton pixel order
+//  +--+--+--+--+          +--+--+--+--+
+//  | 0| 1| 2| 3|          | 0| 1| 4| 5|
+//  +--+--+--+--+          +--+--+--+--+
+//  | 4| 5| 6| 7|   --->   | 2| 3| 6| 7|
+//  +--+--+--+--+          +--+--+--+--+
+//  | 8| 9|10|11|          | 8| 9|12|13|
+//  +--+--+--+--+          +--+--+--+--+
+
+#define LAUNCH_TILE_DIM 8
+
+// Pick every other bit of a 6-bit Morton code (bits 0, 2, 4 -> 0, 1, 2)
+inline uint mortonCompact3(uint v)
+{
+    return (v & 0x1) | ((v >> 1) & 0x2) | ((v >> 2) & 0x4);
+}
+
+// Pixel coordinate <x, y> of the current work item.
+// Can be outside of the image when the extent is not a multiple of the tile size,
+// check with isLaunchIDValid() before writing any output.
+inline int2 getLaunchID()
+{
+    uint gx = get_global_id(0);
+    uint gy = get_global_id(1);
+
+    uint tileIndex = (gy % LAUNCH_TILE_DIM) * LAUNCH_TILE_DIM + (gx % LAUNCH_TILE_DIM);
+    int2 id = {
+        (int)((gx / LAUNCH_TILE_DIM) * LAUNCH_TILE_DIM + mortonCompact3(tileIndex)),
+        (int)((gy / LAUNCH_TILE_DIM) * LAUNCH_TILE_DIM + mortonCompact3(tileIndex >> 1))
+    };
+    return id;
+}
+
+inline bool isLaunchIDValid(int2 id, int width, int height)
+{
+    return id.x < width && id.y < height;
+}
+
+// Row major pixel index of a launch id, for accessing image data
+inline int getLaunchIndex(int2 id, int width)
+{
+    return id.y * width + id.x;
+}
+
+// Unique id of the work item over the whole (padded) launch.
+// Stable for a given pixel, suitable as random seed.
+inline uint getLaunchLinearID()
+{
+    return (uint)(get_global_id(1) * get_global_size(0) + get_global_id(0));
+}
+
+#endif
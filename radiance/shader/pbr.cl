@@ -409,7 +409,9 @@ struct MeshInfo
     int normalOffset;
 
     int materialIndex;
-    int _0, _1, _2;
+    int indexFormat;  // ATTRIBUTE_*, see attribute.cl
+    int uvFormat;
+    int normalFormat;
 };
 
 struct DirLight
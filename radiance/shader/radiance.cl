@@ -1,6 +1,8 @@
 
 #include "data.cl"
 #include "math.cl"
+#include "launch.cl"
+#include "texture.cl"
 
 struct Payload;
 struct SceneData;
@@ -17,31 +19,83 @@ struct HitData
     mat4x4 transform;                   // gl_ObjectToWorldEXT 4x3 matrix
 };
 
-/* User defined begin */
+// Closest hit so far during traversal. The instance fields and transform of HitData
+// are resolved from the instance once traversal ends, see resolveHit().
+struct HitState
+{
+    float distance;
+    float3 barycentric;
+    unsigned int primitiveIndex;
+    unsigned int instance;              // Index in the top-level instance array
+};
+
+// Set to 0 by pipelines without any-hit shaders to drop the call from traversal
+#ifndef RD_HAS_ANY_HIT
+#define RD_HAS_ANY_HIT 1
+#endif
+
+/* User defined begin, generated from the pipeline shader groups */
 struct Payload;
 
 void callHit(int sbtRecordOffset, struct Payload* payload, struct HitData* hitData,
-    struct SceneData* sceneData, image2d_array_t imageArray, sampler_t sampler);
+    struct SceneData* sceneData);
 void callMiss(int missIndex, struct Payload* payload, 
-    struct SceneData* sceneData, image2d_array_t imageArray, sampler_t sampler);
+    struct SceneData* sceneData);
 void callAnyHit(bool* cont, int sbtRecordOffset, struct Payload* payload, struct HitData* hitData,
-    struct SceneData* sceneData, image2d_array_t imageArray, sampler_t sampler);
+    struct SceneData* sceneData);
 /* User defined end */
 
+// Whether the group at an SBT index has an any-hit shader, generated with the dispatch
+// (RD_ANY_HIT_GROUPS). Pipelines with their own dispatch call any-hit for every group.
+#ifdef RD_ANY_HIT_GROUPS
+bool groupHasAnyHit(int index);
+#else
+#define groupHasAnyHit(index) RD_HAS_ANY_HIT
+#endif
+
 
 bool intersectTriangle(float3 origin, float3 direction, 
-                       __global const struct Triangle* triangle, __global Vertex* vertexList,
+                       __global const struct Triangle* triangle,
+                       __global const float* vertexList, unsigned int vertexStride,
                        float3* intersectPoint, float* distance, float3* bary);
 bool intersectAABB(float3 rayOrigin, float3 rayDir, float3 boxMin, float3 boxMax);
 
+// Fill the HitData of the closest hit from its instance, origin and direction are the
+// world space ray
+void resolveHit(__global struct AccelStruct* topLevel, const struct HitState* state,
+    float3 origin, float3 direction, struct HitData* hitData)
+{
+    __global struct Instance* instance = &TO_INST(topLevel)[state->instance];
+    hitData->distance            = state->distance;
+    hitData->barycentric         = state->barycentric;
+    hitData->primitiveIndex      = state->primitiveIndex;
+    hitData->instanceIndex       = instance->instanceID;
+    hitData->instanceCustomIndex = instance->customInstanceID;
+    hitData->instanceSBTOffset   = instance->SBTOffset;
+
+    // The instance transform is affine so the distance is the same along the local ray
+    mat4x4 inverse;
+    float4 worldPoint = (float4)(origin + direction * state->distance, 1.0f);
+    float4 localPoint;
+    Vec4ToMat4x4(instance->r0, instance->r1, instance->r2, instance->r3, &hitData->transform);
+    InverseMat4x4(&hitData->transform, &inverse);
+    MultiplyMat4Vec4(&inverse, &worldPoint, &localPoint);
+    hitData->hitPoint = localPoint.xyz;
+}
+
 
 #define BVH_TOP_STACK_SIZE 8
 #define BVH_BOT_STACK_SIZE 100
 
+// instance is the index of the instance being traversed and transform its matrix,
+// origin and direction are in its object space. anyHit tells whether the instance's
+// group has an any-hit shader, the transform is only read for it.
 bool intersectBot(
-    __global struct AccelStruct* accelStruct, float3 origin, float3 direction,
-    float Tmin, float Tmax, struct HitData* hitData, bool* cont, int sbtRecordOffset,
-    struct Payload* payload, struct SceneData* sceneData, image2d_array_t imageArray, sampler_t sampler)
+    __global struct AccelStruct* topLevel, __global struct AccelStruct* accelStruct,
+    __global const float* vertexData, unsigned int instance, mat4x4* transform,
+    float3 origin, float3 direction,
+    float Tmin, float Tmax, struct HitState* state, bool anyHit, bool* cont, int sbtRecordOffset,
+    struct Payload* payload, struct SceneData* sceneData)
 {
     bool hasIntersected = false;
 	unsigned int stack[BVH_BOT_STACK_SIZE];     // Stack pointing to BVH node index
@@ -76,7 +130,8 @@ bool intersectBot(
 		}
         else if (node->node.leaf._type == TYPE_TRIG)
         {
-            __global Vertex* vertexList = TO_VERTEX(accelStruct);
+            __global const float* vertexList = TO_POSITION(accelStruct, vertexData);
+            unsigned int vertexStride = accelStruct->u.bot.vertexStride;
             __global struct Triangle* faceList = TO_FACE(accelStruct);
 
             // loop over every triangle in the leaf node
@@ -87,18 +142,34 @@ bool intersectBot(
                 float3 intersectPoint;
                 float distance;
                 float3 bary;
-                if (intersectTriangle(origin, direction, face, vertexList, &intersectPoint, &distance, &bary) &&
-                    distance < hitData->distance && distance > Tmin && distance < Tmax)
+                if (intersectTriangle(origin, direction, face, vertexList, vertexStride, &intersectPoint, &distance, &bary) &&
+                    distance < state->distance && distance > Tmin && distance < Tmax)
                 {
-                    hitData->distance       = distance;
-                    hitData->hitPoint       = intersectPoint;
-                    hitData->primitiveIndex = face->primID;
-                    hitData->barycentric    = bary;
+                    state->distance       = distance;
+                    state->barycentric    = bary;
+                    state->primitiveIndex = face->primID;
+                    state->instance       = instance;
 
                     hasIntersected = true;
-                    callAnyHit(cont, sbtRecordOffset, payload, hitData, sceneData, imageArray, sampler);
-                    if (*cont == false)
-                        return hasIntersected;
+#if RD_HAS_ANY_HIT
+                    if (anyHit)
+                    {
+                        // Built from the instance already in use, no inverse needed
+                        __global struct Instance* inst = &TO_INST(topLevel)[instance];
+                        struct HitData hitData;
+                        hitData.hitPoint            = intersectPoint;
+                        hitData.distance            = distance;
+                        hitData.primitiveIndex      = face->primID;
+                        hitData.instanceIndex       = inst->instanceID;
+                        hitData.instanceCustomIndex = inst->customInstanceID;
+                        hitData.instanceSBTOffset   = inst->SBTOffset;
+                        hitData.barycentric         = bary;
+                        hitData.transform           = *transform;
+                        callAnyHit(cont, sbtRecordOffset, payload, &hitData, sceneData);
+                        if (*cont == false)
+                            return hasIntersected;
+                    }
+#endif
                 }
             }
         }
@@ -108,9 +179,10 @@ bool intersectBot(
 }
 
 bool intersectTop(
-    __global struct AccelStruct* accelStruct, float3 origin, float3 direction,
-    float Tmin, float Tmax, struct HitData* hitData, int sbtRecordOffset,
-    struct Payload* payload, struct SceneData* sceneData, image2d_array_t imageArray, sampler_t sampler)
+    __global struct AccelStruct* accelStruct, __global const float* vertexData,
+    float3 origin, float3 direction,
+    float Tmin, float Tmax, struct HitState* state, int sbtRecordOffset,
+    struct Payload* payload, struct SceneData* sceneData)
 {
     bool hasIntersected = false;
 	unsigned int stack[BVH_TOP_STACK_SIZE];     // Stack pointing to BVH node index
@@ -150,40 +222,30 @@ bool intersectTop(
 
             for (unsigned int i = 0; i < GET_COUNT(node); i++)
             {
-                __global struct Instance* instance = &instanceList[node->node.leaf._startIndexList + i];
+                unsigned int instanceIndex = node->node.leaf._startIndexList + i;
+                __global struct Instance* instance = &instanceList[instanceIndex];
                 __global struct AccelStruct* botAccelStruct = TO_BOT_AS(accelStruct, instance);
 
-                mat4x4 transform                    = hitData->transform;
-                unsigned int instanceIndex          = hitData->instanceIndex;         // Top-level instance index (gl_InstanceID)
-                unsigned int instanceCustomIndex    = hitData->instanceCustomIndex;   // Top-level instance custom index (gl_InstanceCustomIndexEXT)
-                unsigned int instanceSBTOffset      = hitData->instanceSBTOffset;     // VkAccelerationStructureInstanceKHR::instanceShaderBindingTableRecordOffset
-
                 float4 rayPos = {origin.x, origin.y, origin.z, 1.0f};
                 float4 rayDir = {direction.x, direction.y, direction.z, 0.0f};
                 float4 localOrigin, localDir;
-                mat4x4 inverse;
+                mat4x4 transform, inverse;
 
-                Vec4ToMat4x4(instance->r0, instance->r1, instance->r2, instance->r3, &hitData->transform);
-                InverseMat4x4(&hitData->transform, &inverse);
+                Vec4ToMat4x4(instance->r0, instance->r1, instance->r2, instance->r3, &transform);
+                InverseMat4x4(&transform, &inverse);
                 MultiplyMat4Vec4(&inverse, &rayPos, &localOrigin);
                 MultiplyMat4Vec4(&inverse, &rayDir, &localDir);
 
-                hitData->instanceIndex       = instance->instanceID;
-                hitData->instanceCustomIndex = instance->customInstanceID;
-                hitData->instanceSBTOffset   = instance->SBTOffset;
+                // Groups without an any-hit shader accept their hits directly
+                bool anyHit = groupHasAnyHit((int)instance->SBTOffset + sbtRecordOffset);
 
-                bool result = intersectBot(botAccelStruct, localOrigin.xyz, localDir.xyz, Tmin, Tmax,
-                    hitData, &cont, sbtRecordOffset, payload, sceneData, imageArray, sampler);
+                // A miss leaves the state of the closest hit untouched, nothing to restore
+                bool result = intersectBot(accelStruct, botAccelStruct, vertexData, instanceIndex,
+                    &transform, localOrigin.xyz, localDir.xyz, Tmin, Tmax,
+                    state, anyHit, &cont, sbtRecordOffset, payload, sceneData);
                 hasIntersected = hasIntersected || result;
                 if (cont == false)
                     return hasIntersected;
-                if (!result)
-                {
-                    hitData->transform = transform;
-                    hitData->instanceIndex = instanceIndex;
-                    hitData->instanceCustomIndex = instanceCustomIndex;
-                    hitData->instanceSBTOffset = instanceSBTOffset;
-                }
             }
         }
 	}
@@ -209,11 +271,13 @@ bool intersectAABB(float3 rayOrigin, float3 rayDir, float3 boxMin, float3 boxMax
 
 // https://en.wikipedia.org/wiki/M%C3%B6ller%E2%80%93Trumbore_intersection_algorithm
 bool intersectTriangle(float3 origin, float3 direction, 
-                       __global const struct Triangle* triangle, __global Vertex* vertexList,
+                       __global const struct Triangle* triangle,
+                       __global const float* vertexList, unsigned int vertexStride,
                        float3* intersectPoint, float* distance, float3* bary)
 {
-    float3 edge1 = vertexList[triangle->idx1].xyz - vertexList[triangle->idx0].xyz;
-    float3 edge2 = vertexList[triangle->idx2].xyz - vertexList[triangle->idx0].xyz;
+    float3 v0 = vload3(0, vertexList + triangle->idx0 * vertexStride);
+    float3 edge1 = vload3(0, vertexList + triangle->idx1 * vertexStride) - v0;
+    float3 edge2 = vload3(0, vertexList + triangle->idx2 * vertexStride) - v0;
 
     float3 ray_cross_e2 = cross(direction, edge2);
     float det = dot(edge1, ray_cross_e2);
@@ -222,7 +286,7 @@ bool intersectTriangle(float3 origin, float3 direction,
         return false;    // This ray is parallel to this triangle.
 
     float inv_det = 1.0f / det;
-    float3 s = origin - vertexList[triangle->idx0].xyz;
+    float3 s = origin - v0;
     float b1 = inv_det * dot(s, ray_cross_e2);
 
     float3 s_cross_e1 = cross(s, edge1);
@@ -251,50 +315,29 @@ bool intersectTriangle(float3 origin, float3 direction,
 }
 
 //!raygen 
+// vertexData holds the positions of bottom level AS built with an external vertex
+// buffer (MeshView::vertexBufferStride), it may be NULL when none is.
 void traceRay(
     __global struct AccelStruct* topLevel,
+    __global const float* vertexData,
     int sbtRecordOffset, int missIndex,
     float3 origin,
     float3 direction,
     float Tmin, float Tmax,
     struct Payload* payload,
-    struct SceneData* sceneData,
-    image2d_array_t imageArray, sampler_t sampler)
+    struct SceneData* sceneData)
 {
-    struct HitData hitData;
-    hitData.distance = FLT_MAX;
-    if (intersectTop(topLevel, origin, direction, Tmin, Tmax, &hitData, sbtRecordOffset,
-        payload, sceneData, imageArray, sampler))
+    struct HitState state;
+    state.distance = FLT_MAX;
+    if (intersectTop(topLevel, vertexData, origin, direction, Tmin, Tmax, &state, sbtRecordOffset,
+        payload, sceneData))
     {
-        callHit(sbtRecordOffset, payload, &hitData, sceneData, imageArray, sampler);
+        struct HitData hitData;
+        resolveHit(topLevel, &state, origin, direction, &hitData);
+        callHit(sbtRecordOffset, payload, &hitData, sceneData);
     }
     else
     {
-        callMiss(missIndex, payload, sceneData, imageArray, sampler);
-    }
-}
-
-/***********************************************************************************
-// case @<index>:@<funct>(payload, &hitData, sceneData);break;
-void callHit(int sbtRecordOffset, struct Payload* payload, struct HitData* hitData, struct SceneData* sceneData)
-{
-    int index = hitData->instanceSBTOffset + sbtRecordOffset;
-    switch (index)
-    {
-        @<insert>
-        default: printf("Error: No hit shader found.");
-    }
-}
-
-
-
-// case @<index>:@<funct>(payload, sceneData);break;
-void callMiss(int missIndex, struct Payload* ray, struct SceneData* sceneData)
-{
-    switch (missIndex)
-    {
-         @<insert>
-         default: printf("Error: No miss shader found.");
+        callMiss(missIndex, payload, sceneData);
     }
 }
-***********************************************************************************************/
\ No newline at end of file
@@ -0,0 +1,97 @@
+#ifndef SURFACE_CL
+#define SURFACE_CL
+
+#include "radiance.cl"
+#include "attribute.cl"
+
+// Shading attributes of a hit, see getSurfaceInteraction().
+//
+// Everything a material reads about the surface is fetched once per hit and kept in
+// registers: the triangle indices, the interpolated UV and normal and a copy of the
+// material. Shaders read the fields instead of going back to the mesh buffers.
+
+// Buffers the interactions are fetched from, laid out as the scene uploads them
+struct SurfaceTable
+{
+    __global const struct MeshInfo* meshInfos;  // per instance index
+    __global const float* vertices;             // float3 positions, also read by traceRay()
+    __global const uint* indices;               // packed streams, see attribute.cl
+    __global const uint* uvs;
+    __global const uint* normals;
+    __global const struct Material* materials;
+};
+
+struct SurfaceInteraction
+{
+    float3 position;            // world space
+    float3 normal;              // interpolated vertex normal, world space
+    float2 uv;
+    float uvLodBias;            // 0.5 * log2(UV area / world area) of the triangle
+    bool hasFootprint;          // uvLodBias is valid, see surfaceConeLod()
+    struct Material material;
+};
+
+// With footprint the triangle area in world and UV space is also measured, it is only
+// needed for ray cone texture LOD and costs the three positions.
+inline struct SurfaceInteraction getSurfaceInteraction(const struct SurfaceTable* table,
+    struct HitData* hitData, bool footprint)
+{
+    struct SurfaceInteraction si;
+    __global const struct MeshInfo* meshInfo = &table->meshInfos[hitData->instanceIndex];
+    uint3 i = attributeIndices(table->indices, meshInfo, hitData->primitiveIndex);
+    float3 b = hitData->barycentric;
+
+    float2 uv0 = attributeUV(table->uvs, meshInfo, i.x);
+    float2 uv1 = attributeUV(table->uvs, meshInfo, i.y);
+    float2 uv2 = attributeUV(table->uvs, meshInfo, i.z);
+    si.uv = b.x * uv0 + b.y * uv1 + b.z * uv2;
+
+    float4 normal = (float4)(
+        b.x * attributeNormal(table->normals, meshInfo, i.x) +
+        b.y * attributeNormal(table->normals, meshInfo, i.y) +
+        b.z * attributeNormal(table->normals, meshInfo, i.z), 0.0f);
+    float4 worldNormal, worldPosition;
+    float4 position = (float4)(hitData->hitPoint, 1.0f);
+    MultiplyMat4Vec4(&hitData->transform, &normal, &worldNormal);
+    MultiplyMat4Vec4(&hitData->transform, &position, &worldPosition);
+    si.normal = normalize(worldNormal.xyz);
+    si.position = worldPosition.xyz;
+
+    si.uvLodBias = 0.0f;
+    si.hasFootprint = false;
+    if (footprint)
+    {
+        // Triangle edges in world space, instance scale changes the footprint
+        __global const float* vertices = table->vertices + meshInfo->vertexOffset;
+        float3 p0 = vload3(i.x, vertices);
+        float4 e1 = (float4)(vload3(i.y, vertices) - p0, 0.0f);
+        float4 e2 = (float4)(vload3(i.z, vertices) - p0, 0.0f);
+        float4 w1, w2;
+        MultiplyMat4Vec4(&hitData->transform, &e1, &w1);
+        MultiplyMat4Vec4(&hitData->transform, &e2, &w2);
+        float worldArea = length(cross(w1.xyz, w2.xyz));
+
+        float2 t1 = uv1 - uv0, t2 = uv2 - uv0;
+        float uvArea = fabs(t1.x * t2.y - t2.x * t1.y);
+
+        si.hasFootprint = worldArea > 0.0f && uvArea > 0.0f;
+        if (si.hasFootprint)
+            si.uvLodBias = 0.5f * log2(uvArea / worldArea);
+    }
+
+    si.material = table->materials[meshInfo->materialIndex];
+    return si;
+}
+
+// Texture independent LOD of a ray cone of the given width at the hit, for textureSampleCone().
+// Ray cones: Akenine-Moller et al., "Texture Level of Detail Strategies for Real-Time Ray Tracing"
+inline float surfaceConeLod(const struct SurfaceInteraction* si, float coneWidth, float3 rayDirection)
+{
+    if (!si->hasFootprint)
+        return 0.0f;
+
+    float cosine = fabs(dot(si->normal, normalize(rayDirection)));
+    return si->uvLodBias + log2(max(fabs(coneWidth), 1e-8f)) - log2(max(cosine, 1e-4f));
+}
+
+#endif // SURFACE_CL
@@ -0,0 +1,309 @@
+#ifndef TEXTURE_CL
+#define TEXTURE_CL
+
+#include "bcn.cl"
+
+// Buffer backed texture table, see TextureInfo in core.h.
+//
+// Textures keep their native size and a full mip chain. Every level of every
+// texture lives in one texel buffer, level i is max(width >> i, 1) texels wide
+// and texel <x, y> of it is at levelOffset[i] + (y * levelWidth + x) * 4.
+// Block formats store 4x4 blocks instead, see bcn.cl.
+// The Morton layout orders texels (or blocks) in row major 8x8 tiles with
+// Morton order inside a tile, so bilinear footprints share cache lines on CPUs.
+// Coordinates are normalized, <0, 0> is the first texel in memory.
+// Addressing and filtering follow the RD_ADDRESS_*/RD_FILTER_* modes of the entry,
+// linear filtering is bilinear within a level and blends between levels.
+// The swizzle maps the stored channels to the sampled ones after filtering.
+
+#define TEXTURE_MAX_LEVELS   16
+
+#define TEXTURE_FORMAT_RGBA8 0
+#define TEXTURE_FORMAT_BC1   1
+#define TEXTURE_FORMAT_BC4   2
+#define TEXTURE_FORMAT_BC5   3
+
+#define TEXTURE_CHANNEL_ZERO     4
+#define TEXTURE_CHANNEL_ONE      5
+#define TEXTURE_CHANNEL_NORMAL_Z 6
+#define TEXTURE_SWIZZLE_RGBA     0x3210
+
+#define TEXTURE_LAYOUT_LINEAR 0
+#define TEXTURE_LAYOUT_MORTON 1
+
+// Virtual texturing, enabled per pipeline with -DTEXTURE_VIRTUAL=1
+#ifndef TEXTURE_VIRTUAL
+#define TEXTURE_VIRTUAL 0
+#endif
+#define TEXTURE_PAGE_SHIFT       16
+#define TEXTURE_PAGE_SIZE        (1u << TEXTURE_PAGE_SHIFT)
+#define TEXTURE_PAGE_NONE        0xffffffffu
+#define TEXTURE_FEEDBACK_USED    1
+#define TEXTURE_FEEDBACK_MISSING 2
+
+// Host RD_ADDRESS_* / RD_FILTER_* values (CL_ADDRESS_*, CL_FILTER_*)
+#define TEXTURE_ADDRESS_NONE            0x1130
+#define TEXTURE_ADDRESS_CLAMP_TO_EDGE   0x1131
+#define TEXTURE_ADDRESS_CLAMP           0x1132
+#define TEXTURE_ADDRESS_REPEAT          0x1133
+#define TEXTURE_ADDRESS_MIRRORED_REPEAT 0x1134
+#define TEXTURE_FILTER_NEAREST          0x1140
+#define TEXTURE_FILTER_LINEAR           0x1141
+
+struct TextureInfo
+{
+    uint width;  // level 0
+    uint height;
+    uint levelCount;
+    uint format;
+    uint swizzle;
+    uint layout;
+    uint addressMode;
+    uint filterMode;
+    uint levelOffset[TEXTURE_MAX_LEVELS];
+};
+
+// Buffers of a texture table. With TEXTURE_VIRTUAL the texels are the page pool of
+// CreateVirtualTexture() and addresses go through the page table.
+struct TextureTable
+{
+    __global const struct TextureInfo* infos;
+    __global const uchar* texels;
+    __global const uint* pageTable; // TEXTURE_VIRTUAL only
+    __global uint* feedback;        // TEXTURE_VIRTUAL only
+};
+
+inline int2 textureLevelSize(__global const struct TextureInfo* info, uint level)
+{
+    int2 size = {max(info->width >> level, 1u), max(info->height >> level, 1u)};
+    return size;
+}
+
+// Index of element <x, y> in a level gridWidth elements wide
+inline uint textureElementIndex(uint layout, uint x, uint y, uint gridWidth)
+{
+    if (layout == TEXTURE_LAYOUT_LINEAR)
+        return y * gridWidth + x;
+
+    uint tx = x & 7, ty = y & 7;
+    tx = (tx | (tx << 2)) & 0x33; tx = (tx | (tx << 1)) & 0x55;
+    ty = (ty | (ty << 2)) & 0x33; ty = (ty | (ty << 1)) & 0x55;
+    uint tilesX = (gridWidth + 7) >> 3;
+    return (((y >> 3) * tilesX + (x >> 3)) << 6) | tx | (ty << 1);
+}
+
+// False when the coordinate falls on the border of RD_ADDRESS_CLAMP
+inline bool textureAddress(uint mode, int size, int* coord)
+{
+    int c = *coord;
+    switch (mode)
+    {
+    case TEXTURE_ADDRESS_REPEAT:
+        c = ((c % size) + size) % size;
+        break;
+    case TEXTURE_ADDRESS_MIRRORED_REPEAT:
+        c = ((c % (2 * size)) + 2 * size) % (2 * size);
+        c = c < size ? c : 2 * size - 1 - c;
+        break;
+    case TEXTURE_ADDRESS_CLAMP:
+        if (c < 0 || c >= size)
+            return false;
+        break;
+    default:
+        c = clamp(c, 0, size - 1);
+        break;
+    }
+    *coord = c;
+    return true;
+}
+
+// Byte address of the element (texel or block) holding texel <x, y>,
+// relative to the texel buffer, virtual with TEXTURE_VIRTUAL
+inline uint textureTexelAddress(__global const struct TextureInfo* info,
+    uint level, int2 size, int x, int y)
+{
+    uint offset = info->levelOffset[level];
+    if (info->format == TEXTURE_FORMAT_RGBA8)
+        return offset + textureElementIndex(info->layout, x, y, size.x) * 4;
+
+    uint blockSize = info->format == TEXTURE_FORMAT_BC5 ? 16 : 8;
+    return offset + textureElementIndex(info->layout, x >> 2, y >> 2, (size.x + 3) >> 2) * blockSize;
+}
+
+#if TEXTURE_VIRTUAL
+inline bool textureResident(const struct TextureTable* table, uint address)
+{
+    return table->pageTable[address >> TEXTURE_PAGE_SHIFT] != TEXTURE_PAGE_NONE;
+}
+
+// Marks the page holding texel <x, y> in the feedback, false when it is not resident.
+// Texels on the border of RD_ADDRESS_CLAMP are not read and count as resident.
+inline bool textureTouchPage(const struct TextureTable* table,
+    __global const struct TextureInfo* info, uint level, int2 size, int x, int y)
+{
+    if (!textureAddress(info->addressMode, size.x, &x) ||
+        !textureAddress(info->addressMode, size.y, &y))
+        return true;
+
+    uint address = textureTexelAddress(info, level, size, x, y);
+    bool resident = textureResident(table, address);
+    uint mark = resident ? TEXTURE_FEEDBACK_USED : TEXTURE_FEEDBACK_MISSING;
+    __global uint* feedback = &table->feedback[address >> TEXTURE_PAGE_SHIFT];
+    if (*feedback != mark)
+        *feedback = mark;
+    return resident;
+}
+
+// First level from `level` on whose whole filter footprint under uv is resident,
+// every page tried is marked in the feedback. The last level is always resident.
+// A footprint straddling a missing page falls back as a whole, reading zero for
+// some of its taps would show the page borders as seams.
+uint textureResidentLevel(const struct TextureTable* table,
+    __global const struct TextureInfo* info, uint level, float2 uv)
+{
+    for (; level + 1 < info->levelCount; level++)
+    {
+        int2 size = textureLevelSize(info, level);
+        bool resident;
+        if (info->filterMode == TEXTURE_FILTER_NEAREST)
+        {
+            int2 p = convert_int2(floor(uv * convert_float2(size)));
+            resident = textureTouchPage(table, info, level, size, p.x, p.y);
+        }
+        else
+        {
+            // Same taps as textureSampleBilinear(), & keeps marking after a miss
+            int2 p = convert_int2(floor(uv * convert_float2(size) - 0.5f));
+            resident = textureTouchPage(table, info, level, size, p.x,     p.y) &
+                       textureTouchPage(table, info, level, size, p.x + 1, p.y) &
+                       textureTouchPage(table, info, level, size, p.x,     p.y + 1) &
+                       textureTouchPage(table, info, level, size, p.x + 1, p.y + 1);
+        }
+
+        if (resident)
+            return level;
+    }
+    return info->levelCount - 1;
+}
+#endif
+
+inline float4 textureFetch(const struct TextureTable* table, __global const struct TextureInfo* info,
+    uint level, int2 size, int x, int y)
+{
+    if (!textureAddress(info->addressMode, size.x, &x) ||
+        !textureAddress(info->addressMode, size.y, &y))
+        return 0.0f;
+
+    uint address = textureTexelAddress(info, level, size, x, y);
+#if TEXTURE_VIRTUAL
+    // textureSampleLevel() only reads resident footprints, this guards direct fetches
+    uint slot = table->pageTable[address >> TEXTURE_PAGE_SHIFT];
+    if (slot == TEXTURE_PAGE_NONE)
+        return 0.0f;
+    __global const uchar* element = table->texels +
+        (((size_t)slot << TEXTURE_PAGE_SHIFT) | (address & (TEXTURE_PAGE_SIZE - 1)));
+#else
+    __global const uchar* element = table->texels + address;
+#endif
+
+    if (info->format == TEXTURE_FORMAT_RGBA8)
+        return convert_float4(vload4(0, element)) * (1.0f / 255.0f);
+
+    uint texel = bcTexelIndex(x, y);
+    switch (info->format)
+    {
+    case TEXTURE_FORMAT_BC1: return bc1Texel(element, texel);
+    case TEXTURE_FORMAT_BC4: return bc4Texel(element, texel);
+    default:                 return bc5Texel(element, texel);
+    }
+}
+
+float4 textureSwizzle(uint swizzle, float4 color)
+{
+    float stored[4] = {color.x, color.y, color.z, color.w};
+    float2 xy = color.xy * 2.0f - 1.0f;
+    float normalZ = sqrt(max(1.0f - dot(xy, xy), 0.0f)) * 0.5f + 0.5f;
+
+    float result[4];
+    for (int i = 0; i < 4; i++)
+    {
+        uint source = (swizzle >> (4 * i)) & 0xf;
+        result[i] = source < 4 ? stored[source] :
+            source == TEXTURE_CHANNEL_ONE ? 1.0f :
+            source == TEXTURE_CHANNEL_NORMAL_Z ? normalZ : 0.0f;
+    }
+
+    float4 swizzled = {result[0], result[1], result[2], result[3]};
+    return swizzled;
+}
+
+float4 textureSampleBilinear(const struct TextureTable* table,
+    __global const struct TextureInfo* info, uint level, float2 uv)
+{
+    int2 size = textureLevelSize(info, level);
+    if (info->filterMode == TEXTURE_FILTER_NEAREST)
+    {
+        float2 p = floor(uv * convert_float2(size));
+        return textureFetch(table, info, level, size, (int)p.x, (int)p.y);
+    }
+
+    float2 p = uv * convert_float2(size) - 0.5f;
+    float2 f = floor(p);
+    float2 t = p - f;
+    int x = (int)f.x, y = (int)f.y;
+
+    float4 c00 = textureFetch(table, info, level, size, x,     y);
+    float4 c10 = textureFetch(table, info, level, size, x + 1, y);
+    float4 c01 = textureFetch(table, info, level, size, x,     y + 1);
+    float4 c11 = textureFetch(table, info, level, size, x + 1, y + 1);
+    return mix(mix(c00, c10, t.x), mix(c01, c11, t.x), t.y);
+}
+
+// lod 0 is full resolution, fractional values blend the two nearest levels
+float4 textureSampleLevel(const struct TextureTable* table, int texIdx, float2 uv, float lod)
+{
+    __global const struct TextureInfo* info = &table->infos[texIdx];
+    lod = clamp(lod, 0.0f, (float)(info->levelCount - 1));
+
+    // Nearest filtering picks the closest level instead of blending two
+    if (info->filterMode == TEXTURE_FILTER_NEAREST)
+        lod = floor(lod + 0.5f);
+
+    uint level = (uint)lod;
+    float blend = lod - (float)level;
+
+#if TEXTURE_VIRTUAL
+    // Coarser levels stand in until the requested pages stream in
+    uint resident = textureResidentLevel(table, info, level, uv);
+    if (resident != level)
+        blend = 0.0f;
+    else if (blend > 0.0f && textureResidentLevel(table, info, level + 1, uv) != level + 1)
+        blend = 0.0f;
+    level = resident;
+#endif
+
+    float4 color = textureSampleBilinear(table, info, level, uv);
+    if (blend > 0.0f)
+        color = mix(color, textureSampleBilinear(table, info, level + 1, uv), blend);
+
+    if (info->swizzle != TEXTURE_SWIZZLE_RGBA)
+        color = textureSwizzle(info->swizzle, color);
+    return color;
+}
+
+inline float4 textureSample(const struct TextureTable* table, int texIdx, float2 uv)
+{
+    return textureSampleLevel(table, texIdx, uv, 0.0f);
+}
+
+// Ray cone lookup, coneLod is the texture independent part of the level
+// (log2 of texels per footprint for a 1x1 texture), the texture size is added here
+inline float4 textureSampleCone(const struct TextureTable* table, int texIdx,
+    float2 uv, float coneLod)
+{
+    __global const struct TextureInfo* info = &table->infos[texIdx];
+    float lod = coneLod + 0.5f * log2((float)info->width * (float)info->height);
+    return textureSampleLevel(table, texIdx, uv, lod);
+}
+
+#endif
@@ -0,0 +1,209 @@
+#include "radiance.h"
+
+#include <cmath>
+#include <cstring>
+
+namespace RD
+{
+
+// Round to nearest even, out of range values become infinity
+uint16_t _floatToHalf(float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    uint32_t sign = (bits >> 16) & 0x8000;
+    int exponent = (int)((bits >> 23) & 0xff) - 127 + 15;
+    uint32_t mantissa = bits & 0x7fffff;
+
+    if (((bits >> 23) & 0xff) == 0xff)
+        return sign | 0x7c00 | (mantissa ? 0x200 : 0);
+    if (exponent >= 31)
+        return sign | 0x7c00;
+
+    if (exponent <= 0)
+    {
+        // Subnormal half, the implicit bit is shifted in
+        if (exponent < -10)
+            return sign;
+        mantissa |= 0x800000;
+        unsigned int shift = 14 - exponent;
+        uint32_t half = mantissa >> shift;
+        uint32_t rest = mantissa & ((1u << shift) - 1);
+        uint32_t halfway = 1u << (shift - 1);
+        if (rest > halfway || (rest == halfway && (half & 1)))
+            half++;
+        return sign | half;
+    }
+
+    uint32_t half = ((uint32_t)exponent << 10) | (mantissa >> 13);
+    uint32_t rest = mantissa & 0x1fff;
+    if (rest > 0x1000 || (rest == 0x1000 && (half & 1)))
+        half++; // a carry into the exponent is still the right rounding
+    return sign | half;
+}
+
+float _halfToFloat(uint16_t half)
+{
+    uint32_t sign = (uint32_t)(half & 0x8000) << 16;
+    uint32_t exponent = (half >> 10) & 0x1f;
+    uint32_t mantissa = half & 0x3ff;
+
+    uint32_t bits;
+    if (exponent == 0x1f)
+        bits = sign | 0x7f800000 | (mantissa << 13);
+    else if (exponent != 0)
+        bits = sign | ((exponent + 127 - 15) << 23) | (mantissa << 13);
+    else if (mantissa == 0)
+        bits = sign;
+    else
+    {
+        // Subnormal half, normalized as a float
+        exponent = 127 - 15 + 1;
+        while (!(mantissa & 0x400))
+        {
+            mantissa <<= 1;
+            exponent--;
+        }
+        bits = sign | (exponent << 23) | ((mantissa & 0x3ff) << 13);
+    }
+
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+uint32_t _packSnorm16x2(float x, float y)
+{
+    int16_t sx = (int16_t)std::lround(std::fmax(-1.0f, std::fmin(1.0f, x)) * 32767.0f);
+    int16_t sy = (int16_t)std::lround(std::fmax(-1.0f, std::fmin(1.0f, y)) * 32767.0f);
+    return (uint32_t)(uint16_t)sx | ((uint32_t)(uint16_t)sy << 16);
+}
+
+// Same decode as octDecode() in attribute.cl
+Vec3 _octDecode(uint32_t packed)
+{
+    float x = std::fmax((int16_t)(packed & 0xffff) / 32767.0f, -1.0f);
+    float y = std::fmax((int16_t)(packed >> 16) / 32767.0f, -1.0f);
+    float z = 1.0f - std::fabs(x) - std::fabs(y);
+    if (z < 0.0f)
+    {
+        float fx = (1.0f - std::fabs(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+        float fy = (1.0f - std::fabs(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+        x = fx;
+        y = fy;
+    }
+    float length = std::sqrt(x * x + y * y + z * z);
+    return Vec3(x / length, y / length, z / length);
+}
+
+// Octahedral normal, the rounding of the two components is chosen to minimize the
+// angular error instead of rounding each one to nearest.
+// Cigolle et al., "A Survey of Efficient Representations for Independent Unit Vectors"
+uint32_t _octEncode(Vec3 n)
+{
+    float length = std::fabs(n.x) + std::fabs(n.y) + std::fabs(n.z);
+    if (length <= 0.0f)
+        return _packSnorm16x2(0.0f, 0.0f); // degenerate, decodes to +z
+
+    float x = n.x / length, y = n.y / length;
+    if (n.z < 0.0f)
+    {
+        float fx = (1.0f - std::fabs(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+        float fy = (1.0f - std::fabs(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+        x = fx;
+        y = fy;
+    }
+
+    float norm = std::sqrt(n.x * n.x + n.y * n.y + n.z * n.z);
+    float fx = std::floor(std::fmax(-1.0f, std::fmin(1.0f, x)) * 32767.0f);
+    float fy = std::floor(std::fmax(-1.0f, std::fmin(1.0f, y)) * 32767.0f);
+    uint32_t best = 0;
+    float bestDot = -2.0f;
+    for (int i = 0; i < 4; i++)
+    {
+        uint32_t packed = _packSnorm16x2((fx + (i & 1)) / 32767.0f, (fy + (i >> 1)) / 32767.0f);
+        Vec3 decoded = _octDecode(packed);
+        float dot = (n.x * decoded.x + n.y * decoded.y + n.z * decoded.z) / norm;
+        if (dot > bestDot)
+        {
+            bestDot = dot;
+            best = packed;
+        }
+    }
+    return best;
+}
+
+bool _uvFitsHalf(const Vec3* uvs, size_t count, float tolerance)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        if (std::fabs(_halfToFloat(_floatToHalf(uvs[i].x)) - uvs[i].x) > tolerance ||
+            std::fabs(_halfToFloat(_floatToHalf(uvs[i].y)) - uvs[i].y) > tolerance)
+            return false;
+    }
+    return true;
+}
+
+uint32_t _floatBits(float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+void AppendMeshAttributes(AttributeStreams& streams, MeshInfo& meshInfo, const MeshView& mesh,
+    const Vec3* uvs, const Vec3* normals, const AttributeDesc& desc)
+{
+    meshInfo.indexFormat = desc.indexFormat;
+    if (mesh.vertexCount > 65536)
+        meshInfo.indexFormat = ATTRIBUTE_INDEX_UINT32;
+
+    meshInfo.uvFormat = desc.uvFormat;
+    if (meshInfo.uvFormat == ATTRIBUTE_UV_HALF2 &&
+        !_uvFitsHalf(uvs, mesh.vertexCount, desc.uvTolerance))
+        meshInfo.uvFormat = ATTRIBUTE_UV_FLOAT2;
+
+    meshInfo.normalFormat = desc.normalFormat;
+
+    // Indices, 16-bit ones are packed in pairs and the stream padded to a word
+    meshInfo.indexOffset = streams.indexData.size();
+    const unsigned int* indices = (const unsigned int*)mesh.indexData;
+    size_t indexCount = mesh.indexCount * 3;
+    if (meshInfo.indexFormat == ATTRIBUTE_INDEX_UINT16)
+    {
+        for (size_t i = 0; i < indexCount; i += 2)
+        {
+            uint32_t next = i + 1 < indexCount ? indices[i + 1] : 0;
+            streams.indexData.push_back(indices[i] | (next << 16));
+        }
+    }
+    else
+        streams.indexData.insert(streams.indexData.end(), indices, indices + indexCount);
+
+    meshInfo.uvOffset = streams.uvData.size();
+    for (size_t i = 0; i < mesh.vertexCount; i++)
+    {
+        if (meshInfo.uvFormat == ATTRIBUTE_UV_HALF2)
+            streams.uvData.push_back(_floatToHalf(uvs[i].x) | ((uint32_t)_floatToHalf(uvs[i].y) << 16));
+        else
+        {
+            streams.uvData.push_back(_floatBits(uvs[i].x));
+            streams.uvData.push_back(_floatBits(uvs[i].y));
+        }
+    }
+
+    meshInfo.normalOffset = streams.normalData.size();
+    for (size_t i = 0; i < mesh.vertexCount; i++)
+    {
+        if (meshInfo.normalFormat == ATTRIBUTE_NORMAL_OCT32)
+            streams.normalData.push_back(_octEncode(normals[i]));
+        else
+        {
+            streams.normalData.push_back(_floatBits(normals[i].x));
+            streams.normalData.push_back(_floatBits(normals[i].y));
+            streams.normalData.push_back(_floatBits(normals[i].z));
+        }
+    }
+}
+
+} // namespace RD
@@ -285,7 +285,7 @@ BVHNode *Recurse(BBoxEntries& work, REPORTPRM(float pct = 0.) int depth = 0)
 }  // end of Recurse() function, returns the rootnode (when all recursion calls have finished)
 
 
-BVHNode *CreateBVH(const std::vector<aiVector3f>& vertices, const std::vector<Triangle>& triangles)
+BVHNode *CreateBVH(const MeshView& mesh)
 {
 	/* Summary:
 	1. Create work BBox
@@ -301,9 +301,10 @@ BVHNode *CreateBVH(const std::vector<aiVector3f>& vertices, const std::vector<Tr
 	aiVector3f top(-FLT_MAX, -FLT_MAX, -FLT_MAX);
 
 	// for each triangle
-	for (unsigned j = 0; j < triangles.size(); j++) {
+	const aiVector3f* vertices = mesh.vertexData;
+	for (unsigned j = 0; j < mesh.indexCount; j++) {
 
-		const Triangle& triangle = triangles[j];
+		const Triangle& triangle = mesh.indexData[j];
 
 		// create a new temporary bbox per triangle 
 		BBoxTmp b;
@@ -499,19 +500,19 @@ void PopulateCacheFriendlyBVH(
 	}
 }
 
-void CreateDeviceBVH(BVHNode* root, const std::vector<Triangle>& faces,
+void CreateDeviceBVH(BVHNode* root, const MeshView& mesh,
     std::vector<DeviceTriangle>& faceList, std::vector<DeviceBVHNode>& nodeList)
 {
-	faceList.resize(faces.size());
+	faceList.resize(mesh.indexCount);
 
 	unsigned int nodeCount = CountBoxes(root);
 	nodeList.resize(nodeCount);
 
     unsigned int faceIdx = 0;
 	unsigned int nodeIdx = 0;
-	PopulateCacheFriendlyBVH(&faces[0], root, faceIdx, nodeIdx, faceList, nodeList);
+	PopulateCacheFriendlyBVH(mesh.indexData, root, faceIdx, nodeIdx, faceList, nodeList);
 
-	if ((nodeIdx != nodeCount - 1) || (faceIdx != faces.size())) {
+	if ((nodeIdx != nodeCount - 1) || (faceIdx != mesh.indexCount)) {
 		puts("Internal bug in CreateCFBVH, please report it..."); fflush(stdout);
 		exit(1);
 	}
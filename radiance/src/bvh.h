@@ -8,6 +8,16 @@ namespace RD
 
 #define MAX_LEAF_PRIM_SIZE 8
 
+// Bottom level AS cache entries (<key>.blas), see BuildAccelStruct().
+// Bump the version whenever the builder output changes for the same input.
+#define ACCEL_CACHE_MAGIC   0x53414452 // "RDAS"
+#define ACCEL_CACHE_VERSION 2
+
+// Top level AS files, see TopAccelStructToFile()
+#define ACCEL_FILE_MAGIC      0x4c545452 // "RTTL"
+#define ACCEL_FILE_VERSION    2
+#define ACCEL_FILE_CHUNK_SIZE (16u << 20) // bytes per streamed transfer
+
 struct BVHNode
 {
 	aiVector3f _bottom;
@@ -34,10 +44,10 @@ struct BVHLeaf: BVHNode
 #define TYPE_TOP_AS 1
 #define TYPE_BOT_AS 2
 
-BVHNode *CreateBVH(const std::vector<aiVector3f>& vertices, const std::vector<Triangle>& triangles);
+BVHNode *CreateBVH(const MeshView& mesh);
 BVHNode *CreateBVH(const std::vector<Instance>& instances);
 
-void CreateDeviceBVH(BVHNode* root, const std::vector<Triangle>& faces,
+void CreateDeviceBVH(BVHNode* root, const MeshView& mesh,
     std::vector<DeviceTriangle>& faceList, std::vector<DeviceBVHNode>& nodeList);
 void CreateDeviceBVH(BVHNode* root, const std::vector<Instance>& faces,
     std::vector<DeviceInstance>& faceList, std::vector<DeviceBVHNode>& nodeList,
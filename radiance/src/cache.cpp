@@ -0,0 +1,67 @@
+#include "cache.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <unistd.h>
+#include <sys/stat.h>
+
+namespace RD
+{
+
+uint64_t HashBytes(const void* data, size_t size, uint64_t hash)
+{
+    const unsigned char* bytes = (const unsigned char*) data;
+    for (size_t i = 0; i < size; i++)
+    {
+        hash ^= bytes[i];
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+uint64_t HashString(const std::string& str, uint64_t hash)
+{
+    // Include the terminator so "ab" + "c" and "a" + "bc" differ
+    return HashBytes(str.c_str(), str.size() + 1, hash);
+}
+
+std::string CachePath(uint64_t key, const char* extension)
+{
+    const char* dir = getenv("RADIANCE_CACHE");
+    std::string cacheDir = dir ? dir : CACHE_DIR;
+    mkdir(cacheDir.c_str(), 0755);
+
+    char fileName[32];
+    snprintf(fileName, sizeof(fileName), "/%016llx", (unsigned long long) key);
+    return cacheDir + fileName + extension;
+}
+
+std::string TempCachePath(const std::string& path)
+{
+    // Unique per writer, threads of one process may store the same entry
+    return path + "." + std::to_string(getpid()) + "." +
+        std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id())) + ".tmp";
+}
+
+bool WriteCacheFile(const std::string& path,
+    const void* header, size_t headerSize, const void* data, size_t size)
+{
+    std::string tmpPath = TempCachePath(path);
+    FILE* file = fopen(tmpPath.c_str(), "wb");
+    if (!file)
+        return false;
+
+    bool written = fwrite(header, 1, headerSize, file) == headerSize &&
+        fwrite(data, 1, size, file) == size;
+    written = fclose(file) == 0 && written;
+
+    if (!written || rename(tmpPath.c_str(), path.c_str()) != 0)
+    {
+        remove(tmpPath.c_str());
+        return false;
+    }
+    return true;
+}
+
+} // namespace RD
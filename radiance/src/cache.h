@@ -0,0 +1,31 @@
+#pragma once
+
+#include <string>
+#include <cstdint>
+
+namespace RD
+{
+
+// On-disk caches (compiled programs, bottom level AS) share one directory.
+// Override the location with the RADIANCE_CACHE environment variable.
+#define CACHE_DIR ".radiance_cache"
+
+#define FNV_OFFSET_BASIS 0xcbf29ce484222325ULL
+#define FNV_PRIME        0x100000001b3ULL
+
+// FNV-1a 64, used to key cache entries
+uint64_t HashBytes(const void* data, size_t size, uint64_t hash);
+uint64_t HashString(const std::string& str, uint64_t hash);
+
+// <cache dir>/<key in hex><extension>, the directory is created on first use
+std::string CachePath(uint64_t key, const char* extension);
+
+// Temporary file next to `path`, unique per process and thread, to rename over it once written
+std::string TempCachePath(const std::string& path);
+
+// Header then payload, written to a temporary file and renamed over `path`
+// so concurrent processes never read a partial entry.
+bool WriteCacheFile(const std::string& path,
+    const void* header, size_t headerSize, const void* data, size_t size);
+
+} // namespace RD
@@ -4,6 +4,7 @@ namespace RD
 {
 
 void CLContext::Cleanup() {
+    if (asyncQueue) clReleaseCommandQueue(asyncQueue);
     if (commandQueue) clReleaseCommandQueue(commandQueue);
     if (context) clReleaseContext(context);
     if (device_id) clReleaseDevice(device_id);
@@ -30,11 +31,33 @@ CLContext* CLContext::GetCLContext()
 
     CL_CHECK(clGetDeviceInfo(ctx->device_id, CL_DEVICE_VENDOR, 256, buffer, &retSize));
     printf("CL_DEVICE_VENDOR: %s\n", buffer);
+
+    // CPU devices and integrated GPUs share memory with the host,
+    // mapping host-allocated buffers there avoids copies entirely.
+    cl_bool unifiedMemory;
+    CL_CHECK(clGetDeviceInfo(ctx->device_id, CL_DEVICE_HOST_UNIFIED_MEMORY,
+        sizeof(unifiedMemory), &unifiedMemory, NULL));
+    ctx->unifiedMemory = unifiedMemory;
+    printf("CL_DEVICE_HOST_UNIFIED_MEMORY: %s\n", unifiedMemory ? "true" : "false");
+
+    cl_device_type deviceType;
+    CL_CHECK(clGetDeviceInfo(ctx->device_id, CL_DEVICE_TYPE,
+        sizeof(deviceType), &deviceType, NULL));
+    ctx->cpuDevice = (deviceType & CL_DEVICE_TYPE_CPU) != 0;
     //////////////////////////////////////////////////////////////////////////////
 
     ctx->context = CL_CHECK2(clCreateContext(NULL, 1, &ctx->device_id, NULL, NULL,  &_err));
     ctx->commandQueue = CL_CHECK2(clCreateCommandQueue(ctx->context, ctx->device_id, 0, &_err));  
 
+    // Command buffers are chained with events, so they can use an out-of-order queue
+    cl_command_queue_properties queueProps;
+    CL_CHECK(clGetDeviceInfo(ctx->device_id, CL_DEVICE_QUEUE_PROPERTIES,
+        sizeof(queueProps), &queueProps, NULL));
+    ctx->outOfOrderQueue = queueProps & CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE;
+    ctx->asyncQueue = CL_CHECK2(clCreateCommandQueue(ctx->context, ctx->device_id,
+        ctx->outOfOrderQueue ? CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE : 0, &_err));
+    printf("Async queue: %s\n", ctx->outOfOrderQueue ? "out-of-order" : "in-order");
+
     fflush(stdout);
     return ctx;
 }
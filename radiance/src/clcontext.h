@@ -19,6 +19,10 @@ public:
     cl_device_id device_id = NULL;
     cl_context context = NULL;
     cl_command_queue commandQueue = NULL;
+    cl_command_queue asyncQueue = NULL; // command buffer submissions
+    bool outOfOrderQueue = false;
+    bool unifiedMemory = false;
+    bool cpuDevice = false;
 
     static CLContext* GetCLContext();
     void Cleanup();
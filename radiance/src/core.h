@@ -6,6 +6,7 @@
 
 #include <list>
 #include <vector>
+#include <string>
 
 
 namespace RD
@@ -39,12 +40,15 @@ struct AccelStructTop // 1 block mapped
     unsigned int totalBufferSize;
 };
 
-struct AccelStructBottom // 1 block mapped
+struct AccelStructBottom // 2 blocks mapped
 {
     unsigned int type;
     unsigned int nodeByteOffset;
     unsigned int faceByteOffset;
-    unsigned int vertexOffset;
+    unsigned int vertexOffset;   // bytes from the header, or floats into the external vertex buffer
+    unsigned int vertexStride;   // floats from one vertex to the next
+    unsigned int vertexExternal; // positions are read from the vertex buffer given to traceRay()
+    unsigned int _0, _1;
 };
 
 struct DeviceInstance
@@ -124,16 +128,75 @@ struct Material
     int normalTexIdx;
 };
 
+// Shading attribute formats of a mesh, see shader/attribute.cl
+#define ATTRIBUTE_INDEX_UINT32  0
+#define ATTRIBUTE_INDEX_UINT16  1 // meshes of at most 65536 vertices
+#define ATTRIBUTE_UV_FLOAT2     0
+#define ATTRIBUTE_UV_HALF2      1
+#define ATTRIBUTE_NORMAL_FLOAT3 0
+#define ATTRIBUTE_NORMAL_OCT32  1 // octahedral, 2x snorm16
+
 struct MeshInfo
 {
     // -1 := not used
+    // vertexOffset counts floats, the attribute offsets 32-bit words of their stream
     int vertexOffset;
     int indexOffset;
     int uvOffset;   
     int normalOffset;
 
     int materialIndex;
-    int _0, _1, _2;
+    int indexFormat;
+    int uvFormat;
+    int normalFormat;
+};
+
+// Texture table entry, see shader/texture.cl.
+// All levels of all textures live in one texel buffer at native resolution,
+// level i is max(width >> i, 1) x max(height >> i, 1) texels.
+#define TEXTURE_MAX_LEVELS   16
+#define TEXTURE_ALIGNMENT    16 // bytes, start of every texture in the texel buffer
+
+// Block formats store 4x4 texel blocks and are decoded per fetch, see shader/bcn.cl
+#define TEXTURE_FORMAT_RGBA8 0
+#define TEXTURE_FORMAT_BC1   1 // RGB, 8 bytes per block
+#define TEXTURE_FORMAT_BC4   2 // one channel, 8 bytes per block
+#define TEXTURE_FORMAT_BC5   3 // two channels, 16 bytes per block
+
+// Where each sampled channel xyzw comes from, 4 bits per channel.
+// Stored channels R/G/B/A are filled from the source channels that select them.
+#define TEXTURE_CHANNEL_R    0
+#define TEXTURE_CHANNEL_G    1
+#define TEXTURE_CHANNEL_B    2
+#define TEXTURE_CHANNEL_A    3
+#define TEXTURE_CHANNEL_ZERO 4
+#define TEXTURE_CHANNEL_ONE  5
+#define TEXTURE_CHANNEL_NORMAL_Z 6 // unit normal z from x and y, in [0, 1] encoding
+#define TEXTURE_SWIZZLE(x, y, z, w) ((x) | (y) << 4 | (z) << 8 | (w) << 12)
+#define TEXTURE_SWIZZLE_RGBA TEXTURE_SWIZZLE(0, 1, 2, 3)
+
+// Order of the texels (RGBA8) or blocks (BC) of a level
+#define TEXTURE_LAYOUT_LINEAR 0 // row major
+#define TEXTURE_LAYOUT_MORTON 1 // row major 8x8 tiles, Morton order inside a tile
+
+// Virtual texturing pages the texel buffer in fixed byte ranges, see CreateVirtualTexture()
+#define TEXTURE_PAGE_SHIFT       16
+#define TEXTURE_PAGE_SIZE        (1u << TEXTURE_PAGE_SHIFT)
+#define TEXTURE_PAGE_NONE        0xffffffffu // page table entry of a page that is not resident
+#define TEXTURE_FEEDBACK_USED    1 // feedback entry: sampled while resident
+#define TEXTURE_FEEDBACK_MISSING 2 // feedback entry: sampled while not resident
+
+struct TextureInfo // mapped
+{
+    unsigned int width;  // level 0
+    unsigned int height;
+    unsigned int levelCount;
+    unsigned int format;
+    unsigned int swizzle;
+    unsigned int layout;
+    unsigned int addressMode; // RD_ADDRESS_*
+    unsigned int filterMode;  // RD_FILTER_*, linear also blends between levels
+    unsigned int levelOffset[TEXTURE_MAX_LEVELS]; // bytes into the texel buffer
 };
 
 struct DirLight
@@ -0,0 +1,323 @@
+#include "pipeline.h"
+#include "program.h"
+
+#include <algorithm>
+
+namespace RD
+{
+
+ShaderModule CreateShaderModule([[maybe_unused]] Platform* platform, const char* code, unsigned int size,
+    const char* name, ShaderStage stage)
+{
+    _ShaderModule* shaderModule = new _ShaderModule();
+    shaderModule->source = std::string(code, size);
+    shaderModule->name = name;
+    shaderModule->stage = stage;
+    return shaderModule;
+}
+
+void DestroyShaderModule(ShaderModule shaderModule)
+{
+    delete shaderModule;
+}
+
+std::string _buildOptions(CompileFlags flags,
+    std::vector<SpecializationConstant> constants)
+{
+    std::string options;
+    if (flags & RD_COMPILE_DEBUG_INFO)
+        options += " -g";
+    if (flags & RD_COMPILE_MAD_ENABLE)
+        options += " -cl-mad-enable";
+    if (flags & RD_COMPILE_FAST_MATH)
+        options += " -cl-fast-relaxed-math";
+
+    // Same constants in a different order are the same variant
+    std::sort(constants.begin(), constants.end(),
+        [](const SpecializationConstant& a, const SpecializationConstant& b) {
+            return a.name < b.name;
+        });
+
+    for (const SpecializationConstant& constant: constants)
+        options += " -D" + constant.name + "=" + std::to_string(constant.value);
+
+    return options;
+}
+
+ShaderModule _groupModule(const PipelineCreateInfo& info,
+    unsigned int groupIndex, unsigned int moduleIndex, ShaderStage stage)
+{
+    if (moduleIndex >= info.modules.size())
+    {
+        printf("Shader group %u references module %u out of %lu\n",
+            groupIndex, moduleIndex, info.modules.size());
+        throw;
+    }
+
+    ShaderModule shaderModule = info.modules[moduleIndex];
+    if (shaderModule->stage != stage)
+    {
+        printf("Shader group %u: module '%s' has the wrong stage\n",
+            groupIndex, shaderModule->name.c_str());
+        throw;
+    }
+    return shaderModule;
+}
+
+// Generate the SBT dispatch functions called by traceRay() in radiance.cl
+std::string _generateDispatch(const PipelineCreateInfo& info, bool* hasAnyHit)
+{
+    std::string hitCases, anyHitCases, anyHitGroups, missCases;
+    *hasAnyHit = false;
+
+    for (unsigned int i = 0; i < info.groups.size(); i++)
+    {
+        const ShaderGroup& group = info.groups[i];
+        std::string index = std::to_string(i);
+
+        if (group.generalShader != SHADER_UNUSED)
+        {
+            if (group.generalShader >= info.modules.size())
+            {
+                printf("Shader group %u references module %u out of %lu\n",
+                    i, group.generalShader, info.modules.size());
+                throw;
+            }
+            ShaderModule general = info.modules[group.generalShader];
+            if (general->stage == MISS_STAGE)
+                missCases += "\t\tcase " + index + ":" + general->name +
+                    "(payload, sceneData);break;\n";
+            else
+                _groupModule(info, i, group.generalShader, RAYGEN_STAGE);
+        }
+
+        if (group.closestHitShader != SHADER_UNUSED)
+        {
+            ShaderModule closestHit = _groupModule(info, i,
+                group.closestHitShader, CLOSEST_HIT_STAGE);
+            hitCases += "\t\tcase " + index + ":" + closestHit->name +
+                "(payload, hitData, sceneData);break;\n";
+        }
+
+        if (group.anyHitShader != SHADER_UNUSED)
+        {
+            ShaderModule anyHit = _groupModule(info, i,
+                group.anyHitShader, ANY_HIT_STAGE);
+            anyHitCases += "\t\tcase " + index + ":" + anyHit->name +
+                "(cont, payload, hitData, sceneData);break;\n";
+            anyHitGroups += "\t\tcase " + index + ":\n";
+            *hasAnyHit = true;
+        }
+    }
+
+    // Traversal asks per instance, groups without any-hit never build the hit data
+    std::string code;
+    code += "\nbool groupHasAnyHit(int index)\n"
+            "{\n"
+            "    switch (index)\n"
+            "    {\n" + anyHitGroups +
+            "\t\t\treturn true;\n"
+            "    }\n"
+            "    return false;\n"
+            "}\n";
+
+    code += "\nvoid callAnyHit(bool* cont, int sbtRecordOffset, struct Payload* payload, struct HitData* hitData,\n"
+            "    struct SceneData* sceneData)\n"
+            "{\n"
+            "    int index = hitData->instanceSBTOffset + sbtRecordOffset;\n"
+            "    switch (index)\n"
+            "    {\n" + anyHitCases +
+            "    }\n"
+            "}\n";
+
+    code += "\nvoid callHit(int sbtRecordOffset, struct Payload* payload, struct HitData* hitData,\n"
+            "    struct SceneData* sceneData)\n"
+            "{\n"
+            "    int index = hitData->instanceSBTOffset + sbtRecordOffset;\n"
+            "    switch (index)\n"
+            "    {\n" + hitCases +
+            "    }\n"
+            "}\n";
+
+    code += "\nvoid callMiss(int missIndex, struct Payload* payload,\n"
+            "    struct SceneData* sceneData)\n"
+            "{\n"
+            "    switch (missIndex)\n"
+            "    {\n" + missCases +
+            "    }\n"
+            "}\n";
+
+    return code;
+}
+
+PipelineVariant* _getVariant(Pipeline pipeline, const std::vector<SpecializationConstant>& constants)
+{
+    std::string options = _buildOptions(pipeline->createInfo.compileFlags, constants);
+    options += pipeline->defines;
+
+    {
+        std::lock_guard<std::mutex> lock(pipeline->variantLock);
+        auto it = pipeline->variants.find(options);
+        if (it != pipeline->variants.end())
+            return &it->second;
+    }
+
+    CLContext* ctx = pipeline->platform->clContext;
+    printf("build pipeline variant:%s\n", options.c_str()); fflush(stdout);
+
+    // Includes are resolved before compiling so the cache key covers the shader library
+    PipelineVariant variant;
+    variant.pushConstants.resize(pipeline->pushConstants.size());
+    variant.program = BuildProgram(ctx, pipeline->source, options);
+
+    const std::vector<ShaderGroup>& groups = pipeline->createInfo.groups;
+    if (groups.empty())
+    {
+        variant.raygen = {CL_CHECK2(clCreateKernel(variant.program, "raygen", &_err))};
+    }
+    else
+    {
+        variant.raygen.resize(groups.size(), NULL);
+        for (unsigned int i = 0; i < groups.size(); i++)
+        {
+            if (groups[i].generalShader == SHADER_UNUSED)
+                continue;
+            ShaderModule general = pipeline->createInfo.modules[groups[i].generalShader];
+            if (general->stage == RAYGEN_STAGE)
+                variant.raygen[i] = CL_CHECK2(clCreateKernel(
+                    variant.program, general->name.c_str(), &_err));
+        }
+    }
+
+    // Another thread may have built the same options meanwhile, keep the first one
+    std::lock_guard<std::mutex> lock(pipeline->variantLock);
+    auto [it, inserted] = pipeline->variants.emplace(options, variant);
+    if (!inserted)
+    {
+        for (cl_kernel raygen: variant.raygen)
+            if (raygen) CL_CHECK(clReleaseKernel(raygen));
+        CL_CHECK(clReleaseProgram(variant.program));
+    }
+    return &it->second;
+}
+
+_Pipeline* _createPipeline(Platform* platform, const PipelineCreateInfo& pipelineCreateInfo)
+{
+    _Pipeline* pipeline = new _Pipeline();
+    pipeline->platform = platform;
+    pipeline->createInfo = pipelineCreateInfo;
+    pipeline->pushConstants.resize(pipelineCreateInfo.layout.pushConstantSizes.size());
+
+    // All modules are compiled as one program
+    std::vector<std::string> sources;
+    for (ShaderModule shaderModule: pipelineCreateInfo.modules)
+    {
+        if (std::find(sources.begin(), sources.end(), shaderModule->source) != sources.end())
+            continue;
+        sources.push_back(shaderModule->source);
+        pipeline->source += shaderModule->source;
+        pipeline->source += '\n';
+    }
+
+    // Without groups the shader provides its own dispatch functions
+    if (!pipelineCreateInfo.groups.empty())
+    {
+        bool hasAnyHit;
+        pipeline->source += _generateDispatch(pipelineCreateInfo, &hasAnyHit);
+
+        // Traversal skips the any-hit call when no group has one
+        pipeline->defines = hasAnyHit ? " -DRD_HAS_ANY_HIT=1" : " -DRD_HAS_ANY_HIT=0";
+        pipeline->defines += " -DRD_ANY_HIT_GROUPS";
+    }
+
+    return pipeline;
+}
+
+Pipeline CreatePipeline(Platform* platform, PipelineCreateInfo pipelineCreateInfo)
+{
+    _Pipeline* pipeline = _createPipeline(platform, pipelineCreateInfo);
+    pipeline->active = _getVariant(pipeline, pipelineCreateInfo.constants);
+    return pipeline;
+}
+
+Pipeline CreatePipelineAsync(Platform* platform, PipelineCreateInfo pipelineCreateInfo)
+{
+    _Pipeline* pipeline = _createPipeline(platform, pipelineCreateInfo);
+
+    // Nothing else touches the pipeline until WaitForPipeline() joins the build
+    pipeline->building = std::async(std::launch::async, [pipeline]() {
+        pipeline->active = _getVariant(pipeline, pipeline->createInfo.constants);
+    });
+    return pipeline;
+}
+
+void WaitForPipeline(Pipeline pipeline)
+{
+    if (pipeline->building.valid())
+        pipeline->building.get();
+    for (std::future<void>& build: pipeline->variantBuilds)
+        build.get();
+    pipeline->variantBuilds.clear();
+}
+
+void SpecializePipeline(Pipeline pipeline, const std::vector<SpecializationConstant>& constants)
+{
+    WaitForPipeline(pipeline);
+    pipeline->createInfo.constants = constants;
+    PipelineVariant* variant = _getVariant(pipeline, constants);
+
+    if (variant == pipeline->active)
+        return;
+
+    CLContext* ctx = pipeline->platform->clContext;
+    pipeline->active = variant;
+    if (!pipeline->boundSet.empty())
+        _bindDescriptorSet(ctx, pipeline, pipeline->boundSet);
+
+    for (unsigned int i = 0; i < pipeline->pushConstants.size(); i++)
+    {
+        const std::vector<char>& data = pipeline->pushConstants[i];
+        if (!data.empty())
+            _pushConstants(ctx, pipeline, i, data.size(), data.data());
+    }
+}
+
+void SpecializePipelineAsync(Pipeline pipeline, const std::vector<SpecializationConstant>& constants)
+{
+    pipeline->variantBuilds.push_back(std::async(std::launch::async, [pipeline, constants]() {
+        _getVariant(pipeline, constants);
+    }));
+}
+
+cl_kernel _raygenKernel(Pipeline pipeline, unsigned int groupIndex)
+{
+    WaitForPipeline(pipeline);
+    const std::vector<cl_kernel>& raygen = pipeline->active->raygen;
+    if (pipeline->createInfo.groups.empty())
+        return raygen[0];
+
+    if (groupIndex >= raygen.size() || raygen[groupIndex] == NULL)
+    {
+        printf("Shader group %u is not a raygen group\n", groupIndex);
+        throw;
+    }
+    return raygen[groupIndex];
+}
+
+void DestroyPipeline(Pipeline pipeline)
+{
+    WaitForPipeline(pipeline);
+    CLContext* ctx = pipeline->platform->clContext;
+    if (pipeline->platform->activePipeline == pipeline)
+        pipeline->platform->activePipeline = nullptr;
+
+    for (auto& [options, variant]: pipeline->variants)
+    {
+        for (cl_kernel raygen: variant.raygen)
+            if (raygen) CL_CHECK(clReleaseKernel(raygen));
+        CL_CHECK(clReleaseProgram(variant.program));
+    }
+    delete pipeline;
+}
+
+} // namespace RD
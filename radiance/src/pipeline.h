@@ -0,0 +1,53 @@
+#pragma once
+#include "radiance.h"
+
+#include <map>
+#include <future>
+#include <mutex>
+
+namespace RD
+{
+
+struct _ShaderModule
+{
+    std::string source;
+    std::string name;
+    ShaderStage stage;
+};
+
+// One compiled instance of the pipeline program
+struct PipelineVariant
+{
+    cl_program program;
+    std::vector<cl_kernel> raygen; // per shader group, NULL if not a raygen group
+
+    // Arguments currently set on the kernels, unchanged ones are not set again
+    DescriptorSet boundSet;
+    std::vector<std::vector<char>> pushConstants;
+};
+
+struct _Pipeline
+{
+    Platform* platform;
+    PipelineCreateInfo createInfo;
+    std::string source; // sources of all modules and the generated SBT dispatch
+    std::string defines; // build options derived from the shader groups
+
+    std::map<std::string, PipelineVariant> variants; // keyed by build options, under variantLock
+    std::mutex variantLock;
+    PipelineVariant* active;
+    // Bound state, re-applied when the active variant changes
+    DescriptorSet boundSet;
+    std::vector<std::vector<char>> pushConstants;
+
+    std::future<void> building; // valid while CreatePipelineAsync() compiles
+    std::vector<std::future<void>> variantBuilds; // SpecializePipelineAsync()
+};
+
+cl_kernel _raygenKernel(Pipeline pipeline, unsigned int groupIndex);
+void _bindDescriptorSet(CLContext* ctx, Pipeline pipeline,
+    const DescriptorSet& descriptorSet);
+void _pushConstants(CLContext* ctx, Pipeline pipeline,
+    unsigned int rangeIndex, unsigned int size, const void* data);
+
+} // namespace RD
@@ -0,0 +1,305 @@
+#include "program.h"
+#include "cache.h"
+
+#include <set>
+#include <sstream>
+#include <cctype>
+#include <cstring>
+#include <cstdint>
+#include <vector>
+
+namespace RD
+{
+
+struct ProgramCacheHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t key;
+    uint64_t binarySize;
+};
+
+const char* FindEmbeddedShader(const EmbeddedShader* table, const char* name)
+{
+    for (const EmbeddedShader* entry = table; entry->name; entry++)
+    {
+        if (strcmp(entry->name, name) == 0)
+            return entry->source;
+    }
+    return nullptr;
+}
+
+// Advances the /* */ state over one line, true when the line holds code
+// outside of comments before any directive could start
+bool _scanComments(const std::string& line, bool& inComment)
+{
+    bool startsInComment = inComment;
+    for (size_t i = 0; i < line.size(); i++)
+    {
+        if (inComment)
+        {
+            if (line.compare(i, 2, "*/") == 0)
+            {
+                inComment = false;
+                i++;
+            }
+        }
+        else if (line.compare(i, 2, "//") == 0)
+            break;
+        else if (line.compare(i, 2, "/*") == 0)
+        {
+            inComment = true;
+            i++;
+        }
+        else if (line[i] == '"')
+        {
+            // Skip string literals, they may hold comment markers
+            for (i++; i < line.size() && line[i] != '"'; i++)
+                if (line[i] == '\\')
+                    i++;
+        }
+    }
+    return !startsInComment;
+}
+
+// Directive name of a preprocessor line ("include", "if", ...), empty for code
+std::string _directive(const std::string& line, size_t* end)
+{
+    size_t hash = line.find_first_not_of(" \t");
+    if (hash == std::string::npos || line[hash] != '#')
+        return "";
+    size_t begin = line.find_first_not_of(" \t", hash + 1);
+    if (begin == std::string::npos)
+        return "";
+    size_t stop = begin;
+    while (stop < line.size() && isalpha((unsigned char)line[stop]))
+        stop++;
+    *end = stop;
+    return line.substr(begin, stop - begin);
+}
+
+void _preprocess(const std::string& source, const std::string& name,
+    std::set<std::string>& included, std::string& output)
+{
+    std::istringstream stream(source);
+    std::string line;
+    unsigned int lineNumber = 0;
+    bool inComment = false;
+    unsigned int disabled = 0; // depth inside #if 0, includes there are not expanded
+    while (std::getline(stream, line))
+    {
+        lineNumber++;
+        size_t end = 0;
+        bool code = _scanComments(line, inComment);
+        std::string directive = code ? _directive(line, &end) : "";
+
+        if (directive == "if" || directive == "ifdef" || directive == "ifndef")
+        {
+            if (disabled > 0)
+                disabled++;
+            else if (directive == "if")
+            {
+                // Only a literal 0 is known here, other conditions are left to the compiler
+                size_t value = line.find_first_not_of(" \t", end);
+                size_t valueEnd = value == std::string::npos ? value : line.find_first_of(" \t/", value);
+                if (value != std::string::npos && line.substr(value, valueEnd - value) == "0")
+                    disabled = 1;
+            }
+        }
+        else if (directive == "else" || directive == "elif")
+        {
+            if (disabled == 1)
+                disabled = 0;
+        }
+        else if (directive == "endif")
+        {
+            if (disabled > 0)
+                disabled--;
+        }
+
+        if (directive != "include" || disabled > 0)
+        {
+            output += line;
+            output += '\n';
+            continue;
+        }
+
+        size_t open = line.find('"', end);
+        size_t close = open == std::string::npos ? open : line.find('"', open + 1);
+        if (close == std::string::npos)
+        {
+            // System headers are left to the compiler
+            output += line;
+            output += '\n';
+            continue;
+        }
+
+        std::string fileName = line.substr(open + 1, close - open - 1);
+        if (included.count(fileName))
+        {
+            // Keep the line count of the including file
+            output += '\n';
+            continue;
+        }
+
+        const char* text = FindEmbeddedShader(shaderLibrary, fileName.c_str());
+        if (!text)
+        {
+            printf("Shader include not found: %s\n", fileName.c_str());
+            throw;
+        }
+
+        // Build errors point at the embedded file and line, not the flattened source
+        included.insert(fileName);
+        output += "#line 1 \"" + fileName + "\"\n";
+        _preprocess(text, fileName, included, output);
+        output += "#line " + std::to_string(lineNumber + 1) + " \"" + name + "\"\n";
+    }
+}
+
+std::string PreprocessProgram(const std::string& source)
+{
+    std::set<std::string> included;
+    std::string output;
+    _preprocess(source, "program", included, output);
+    return output;
+}
+
+std::string _deviceIdentity(CLContext* ctx)
+{
+    char buffer[256];
+    std::string identity;
+
+    const cl_device_info deviceInfo[] = {CL_DEVICE_NAME, CL_DEVICE_VERSION, CL_DRIVER_VERSION};
+    for (cl_device_info info: deviceInfo)
+    {
+        CL_CHECK(clGetDeviceInfo(ctx->device_id, info, sizeof(buffer), buffer, NULL));
+        identity += buffer;
+        identity += ';';
+    }
+
+    const cl_platform_info platformInfo[] = {CL_PLATFORM_NAME, CL_PLATFORM_VERSION};
+    for (cl_platform_info info: platformInfo)
+    {
+        CL_CHECK(clGetPlatformInfo(ctx->platform_id, info, sizeof(buffer), buffer, NULL));
+        identity += buffer;
+        identity += ';';
+    }
+
+    return identity;
+}
+
+void _printBuildLog(CLContext* ctx, cl_program program)
+{
+    char log[10000];
+    size_t retSize;
+    clGetProgramBuildInfo(program, ctx->device_id, CL_PROGRAM_BUILD_LOG, 10000, log, &retSize);
+    printf("error output: %s\n", log);
+}
+
+// Returns NULL on a miss, or when the cached file does not match the key.
+cl_program _loadCachedProgram(CLContext* ctx, const std::string& path,
+    uint64_t key, const std::string& options)
+{
+    FILE* file = fopen(path.c_str(), "rb");
+    if (!file)
+        return NULL;
+
+    ProgramCacheHeader header;
+    std::vector<unsigned char> binary;
+    bool valid = fread(&header, sizeof(header), 1, file) == 1 &&
+        header.magic == PROGRAM_CACHE_MAGIC &&
+        header.version == PROGRAM_CACHE_VERSION &&
+        header.key == key;
+
+    if (valid)
+    {
+        binary.resize(header.binarySize);
+        valid = fread(binary.data(), 1, binary.size(), file) == binary.size();
+    }
+    fclose(file);
+
+    if (!valid)
+    {
+        printf("Program cache entry %s is stale, rebuilding\n", path.c_str());
+        return NULL;
+    }
+
+    const unsigned char* binaries[1] = {binary.data()};
+    const size_t binarySizes[1] = {binary.size()};
+    cl_int binaryStatus, err;
+    cl_program program = clCreateProgramWithBinary(ctx->context, 1, &ctx->device_id,
+        binarySizes, binaries, &binaryStatus, &err);
+    if (err != CL_SUCCESS || binaryStatus != CL_SUCCESS)
+    {
+        printf("Program cache entry %s rejected by the driver, rebuilding\n", path.c_str());
+        return NULL;
+    }
+
+    if (clBuildProgram(program, 1, &ctx->device_id, options.c_str(), NULL, NULL) < 0)
+    {
+        printf("Program cache entry %s failed to build, rebuilding\n", path.c_str());
+        clReleaseProgram(program);
+        return NULL;
+    }
+
+    return program;
+}
+
+void _storeCachedProgram(CLContext* ctx, cl_program program,
+    const std::string& path, uint64_t key)
+{
+    size_t binarySize;
+    CL_CHECK(clGetProgramInfo(program, CL_PROGRAM_BINARY_SIZES,
+        sizeof(size_t), &binarySize, NULL));
+
+    std::vector<unsigned char> binary(binarySize);
+    unsigned char* binaries[1] = {binary.data()};
+    CL_CHECK(clGetProgramInfo(program, CL_PROGRAM_BINARIES,
+        sizeof(binaries), binaries, NULL));
+
+    ProgramCacheHeader header = {
+        .magic = PROGRAM_CACHE_MAGIC,
+        .version = PROGRAM_CACHE_VERSION,
+        .key = key,
+        .binarySize = binarySize
+    };
+
+    if (!WriteCacheFile(path, &header, sizeof(header), binary.data(), binary.size()))
+        printf("Failed to write program cache entry %s\n", path.c_str());
+}
+
+cl_program BuildProgram(CLContext* ctx, const std::string& source, const std::string& options)
+{
+    std::string flattened = PreprocessProgram(source);
+
+    uint64_t key = FNV_OFFSET_BASIS;
+    key = HashString(flattened, key);
+    key = HashString(options, key);
+    key = HashString(_deviceIdentity(ctx), key);
+
+    std::string path = CachePath(key, ".bin");
+    cl_program program = _loadCachedProgram(ctx, path, key, options);
+    if (program)
+    {
+        printf("Program loaded from cache: %s\n", path.c_str());
+        return program;
+    }
+
+    const char* programs[1] = {flattened.c_str()};
+    const size_t programSizes[1] = {flattened.size()};
+    program = CL_CHECK2(clCreateProgramWithSource(
+        ctx->context, 1, programs, programSizes, &_err));
+
+    if (clBuildProgram(program, 1, &ctx->device_id, options.c_str(), NULL, NULL) < 0)
+    {
+        _printBuildLog(ctx, program);
+        throw;
+    }
+
+    _storeCachedProgram(ctx, program, path, key);
+    printf("Program built and cached: %s\n", path.c_str());
+    return program;
+}
+
+} // namespace RD
@@ -0,0 +1,23 @@
+#pragma once
+#include "clcontext.h"
+#include "shaderlib.h"
+
+#include <string>
+
+namespace RD
+{
+
+// Compiled programs are cached on disk (see cache.h), keyed by a hash of the
+// flattened source, the build options and the device/driver identity.
+#define PROGRAM_CACHE_MAGIC   0x42504452 // "RDPB"
+#define PROGRAM_CACHE_VERSION 1
+
+// Inline every #include "file" from the embedded shader library, each file at most once.
+// Includes in comments or #if 0 blocks are kept as they are, spliced files are
+// wrapped in #line directives so build logs name the original file and line.
+std::string PreprocessProgram(const std::string& source);
+
+// Build a program from source, or load its binary from the cache on a hit.
+cl_program BuildProgram(CLContext* ctx, const std::string& source, const std::string& options);
+
+} // namespace RD
@@ -1,5 +1,15 @@
 #include "radiance.h"
 #include "bvh.h"
+#include "pipeline.h"
+#include "cache.h"
+
+#include <cstring>
+#include <algorithm>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 
 namespace RD
@@ -8,33 +18,112 @@ namespace RD
 void _buildBottomAccelStruct(CLContext* ctx,
     const std::vector<DeviceBVHNode>& nodeList,
     const std::vector<DeviceTriangle>& faceList,
-    const std::vector<Vec3>& vertexList,
+    const MeshView& mesh,
     std::vector<char>& data);
 
-TopAccelStruct _buildTopAccelStruct(CLContext* ctx,
+TopAccelStruct _buildTopAccelStruct(Platform* platform,
     const std::vector<DeviceBVHNode>& nodeList,
     const std::vector<DeviceInstance>& deviceInstList,
     const std::vector<Instance>& instList,
     const std::map<BottomAccelStruct, unsigned int>& instOffsetMap);
 
+struct AccelCacheHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t key;
+    uint64_t dataSize;
+};
+
+// Mesh content plus everything that shapes the builder output
+uint64_t _accelCacheKey(const MeshView& mesh)
+{
+    const uint32_t settings[] = {
+        ACCEL_CACHE_VERSION, MAX_LEAF_PRIM_SIZE,
+        sizeof(AccelStructBottom), sizeof(DeviceBVHNode),
+        sizeof(DeviceTriangle), sizeof(DeviceVertex)
+    };
+
+    uint64_t count[] = {mesh.vertexCount, mesh.indexCount,
+        mesh.vertexBufferOffset, mesh.vertexBufferStride};
+    uint64_t key = FNV_OFFSET_BASIS;
+    key = HashBytes(settings, sizeof(settings), key);
+    key = HashBytes(count, sizeof(count), key);
+    key = HashBytes(mesh.vertexData, mesh.vertexCount * sizeof(Vec3), key);
+    key = HashBytes(mesh.indexData, mesh.indexCount * sizeof(Triangle), key);
+    return key;
+}
+
+bool _loadCachedAccelStruct(const std::string& path, uint64_t key, std::vector<char>& data)
+{
+    FILE* file = fopen(path.c_str(), "rb");
+    if (!file)
+        return false;
+
+    AccelCacheHeader header;
+    bool valid = fread(&header, sizeof(header), 1, file) == 1 &&
+        header.magic == ACCEL_CACHE_MAGIC &&
+        header.version == ACCEL_CACHE_VERSION &&
+        header.key == key &&
+        header.dataSize >= sizeof(AccelStructBottom);
+
+    if (valid)
+    {
+        data.resize(header.dataSize);
+        valid = fread(data.data(), 1, data.size(), file) == data.size();
+    }
+    fclose(file);
+
+    if (!valid)
+    {
+        printf("AccelStruct cache entry %s is stale, rebuilding\n", path.c_str());
+        data.clear();
+    }
+    return valid;
+}
+
 BottomAccelStruct BuildAccelStruct(Platform* platform, Mesh& mesh)
 {
+    MeshView view = {
+        .vertexData  = mesh.vertexData.data(),
+        .vertexCount = mesh.vertexData.size(),
+        .indexData   = mesh.indexData.data(),
+        .indexCount  = mesh.indexData.size()
+    };
+    return BuildAccelStruct(platform, view);
+}
+
+BottomAccelStruct BuildAccelStruct(Platform* platform, const MeshView& mesh)
+{
+    if (mesh.vertexBufferStride != 0 && mesh.vertexBufferStride < 3)
+    {
+        printf("Vertex buffer stride %u is smaller than a position\n", mesh.vertexBufferStride);
+        throw;
+    }
+
+    // Unchanged meshes are loaded from the cache, across scenes and runs
+    uint64_t key = _accelCacheKey(mesh);
+    std::string cachePath = CachePath(key, ".blas");
+
+    _BottomAccelStruct* accelStruct = new _BottomAccelStruct();
+    accelStruct->root = nullptr;
+    if (_loadCachedAccelStruct(cachePath, key, accelStruct->data))
+        return accelStruct;
+
     printf("\nStart building bottom level BVH\n");
-    printf("\tVertex count:%ld\n", mesh.vertexData.size());
-    printf("\tTriangle count:%ld\n", mesh.indexData.size());
+    printf("\tVertex count:%ld\n", mesh.vertexCount);
+    printf("\tTriangle count:%ld\n", mesh.indexCount);
     time_t start_t, end_t;
     double diff_t;
     time(&start_t);
 
     CLContext* ctx = platform->clContext;
-    BVHNode* root = CreateBVH(mesh.vertexData, mesh.indexData);
-
-    _BottomAccelStruct* accelStruct = new _BottomAccelStruct();
+    BVHNode* root = CreateBVH(mesh);
     accelStruct->root = root;
 
     std::vector<DeviceTriangle> deviceTrigList;
     std::vector<DeviceBVHNode> nodeList;
-    CreateDeviceBVH(root, mesh.indexData, deviceTrigList, nodeList);
+    CreateDeviceBVH(root, mesh, deviceTrigList, nodeList);
 
 #ifdef DATA_LAYOUT_DEBUG
     printf("device face list size: %ld\n", deviceTrigList.size());
@@ -42,7 +131,17 @@ BottomAccelStruct BuildAccelStruct(Platform* platform, Mesh& mesh)
 #endif
 
     _buildBottomAccelStruct(ctx, nodeList, deviceTrigList,
-        mesh.vertexData, accelStruct->data);
+        mesh, accelStruct->data);
+
+    AccelCacheHeader header = {
+        .magic = ACCEL_CACHE_MAGIC,
+        .version = ACCEL_CACHE_VERSION,
+        .key = key,
+        .dataSize = accelStruct->data.size()
+    };
+    if (!WriteCacheFile(cachePath, &header, sizeof(header),
+        accelStruct->data.data(), accelStruct->data.size()))
+        printf("Failed to write AccelStruct cache entry %s\n", cachePath.c_str());
 
     time(&end_t);
     diff_t = difftime(end_t, start_t);
@@ -51,6 +150,55 @@ BottomAccelStruct BuildAccelStruct(Platform* platform, Mesh& mesh)
     return accelStruct;
 }
 
+void ReorderAccelStructMesh(BottomAccelStruct accelStruct, size_t vertexCount,
+    std::vector<unsigned int>& faceOrder, std::vector<unsigned int>& vertexOrder)
+{
+    // Faces are stored leaf by leaf, depth first, see PopulateCacheFriendlyBVH()
+    char* ptr = accelStruct->data.data();
+    AccelStructBottom* header = (AccelStructBottom*)ptr;
+    size_t faceEnd = header->vertexExternal ? accelStruct->data.size() : header->vertexOffset;
+    DeviceTriangle* faceList = (DeviceTriangle*)(ptr + header->faceByteOffset);
+    size_t faceCount = (faceEnd - header->faceByteOffset) / sizeof(DeviceTriangle);
+
+    std::vector<unsigned int> remap(vertexCount, ~0u);
+    auto renumber = [&](unsigned int& idx) {
+        if (remap[idx] == ~0u)
+        {
+            remap[idx] = vertexOrder.size();
+            vertexOrder.push_back(idx);
+        }
+        idx = remap[idx];
+    };
+
+    faceOrder.resize(faceCount);
+    vertexOrder.clear();
+    vertexOrder.reserve(vertexCount);
+    for (size_t i = 0; i < faceCount; i++)
+    {
+        DeviceTriangle& face = faceList[i];
+        faceOrder[i] = face.primID;
+        face.primID = i;
+        renumber(face.idx0);
+        renumber(face.idx1);
+        renumber(face.idx2);
+    }
+
+    // Vertices no triangle uses keep their relative order at the end
+    for (unsigned int i = 0; i < vertexCount; i++)
+    {
+        unsigned int idx = i;
+        renumber(idx);
+    }
+
+    if (header->vertexExternal)
+        return;
+
+    DeviceVertex* vertexList = (DeviceVertex*)(ptr + header->vertexOffset);
+    std::vector<DeviceVertex> original(vertexList, vertexList + vertexCount);
+    for (size_t i = 0; i < vertexCount; i++)
+        vertexList[i] = original[vertexOrder[i]];
+}
+
 TopAccelStruct BuildAccelStruct(Platform* platform, std::vector<Instance>& instances)
 {
     printf("\nStart building top level BVH\n");
@@ -59,7 +207,6 @@ TopAccelStruct BuildAccelStruct(Platform* platform, std::vector<Instance>& insta
     double diff_t;
     time(&start_t);
 
-    CLContext* ctx = platform->clContext;
     BVHNode* root = CreateBVH(instances);
 
     std::vector<DeviceInstance> deviceInstList;
@@ -73,7 +220,7 @@ TopAccelStruct BuildAccelStruct(Platform* platform, std::vector<Instance>& insta
     printf("Instance offset list size: %ld\n", instOffsetList.size());
 #endif
 
-    TopAccelStruct topAccelStruct = _buildTopAccelStruct(ctx,
+    TopAccelStruct topAccelStruct = _buildTopAccelStruct(platform,
         nodeList, deviceInstList, instances, instOffsetList);
 
     time(&end_t);
@@ -83,13 +230,26 @@ TopAccelStruct BuildAccelStruct(Platform* platform, std::vector<Instance>& insta
     return topAccelStruct;
 }
 
-Image CreateImage(Platform* platform, unsigned int width, unsigned int height)
+cl_mem_flags _memFlags(MemoryFlags flags)
 {
-    CLContext* ctx = platform->clContext;
-    cl_mem handle = CL_CHECK2(clCreateBuffer(
-        ctx->context, CL_MEM_READ_WRITE, width * height * CHANNEL, NULL, &_err));
+    switch (flags)
+    {
+    case RD_MEMORY_DEVICE:
+        return CL_MEM_READ_WRITE;
+    case RD_MEMORY_HOST_ALLOC:
+        return CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR;
+    case RD_MEMORY_HOST_PTR:
+        return CL_MEM_READ_WRITE | CL_MEM_USE_HOST_PTR;
+    default:
+        printf("Unknown memory flags: %u\n", flags);
+        throw;
+    }
+}
 
-    return handle;
+Image CreateImage(Platform* platform, unsigned int width, unsigned int height,
+    MemoryFlags flags, void* hostPtr)
+{
+    return CreateBuffer(platform, width * height * CHANNEL, flags, hostPtr);
 }
 
 
@@ -130,11 +290,18 @@ Sampler CreateSampler(Platform* platform,
     return sampler;
 }
 
-Buffer CreateBuffer(Platform* platform, unsigned int size)
+Buffer CreateBuffer(Platform* platform, size_t size,
+    MemoryFlags flags, void* hostPtr)
 {
     CLContext* ctx = platform->clContext;
+    if ((flags == RD_MEMORY_HOST_PTR) != (hostPtr != nullptr))
+    {
+        printf("Host pointer must be given if and only if RD_MEMORY_HOST_PTR is used\n");
+        throw;
+    }
+
     cl_mem handle = CL_CHECK2(clCreateBuffer(
-        ctx->context, CL_MEM_READ_WRITE, size, NULL, &_err));
+        ctx->context, _memFlags(flags), size, hostPtr, &_err));
 
     return handle;
 }
@@ -144,43 +311,10 @@ DescriptorSet CreateDescriptorSet(std::vector<Handle> handles)
     return handles;
 }
 
-PipelineLayout CreatePipelineLayout(std::vector<DescriptorType> descriptorTypes)
-{
-    return descriptorTypes;
-}
-
-ShaderModule CreateShaderModule(Platform* platform, char* code, unsigned int size, char* name)
-{
-    CLContext* ctx = platform->clContext;
-    cl_program tracingProgram;
-    cl_int libraryStatus;
-
-    const char* programs[1] = {code};
-    const size_t programSizes[1] = {size};
-    tracingProgram = CL_CHECK2(clCreateProgramWithSource(
-        ctx->context, 1, programs, programSizes, &_err));
-    
-    printf("build program and get raygen kernel\n"); fflush(stdout);
-
-    std::string includeDir = SHADER_LIB_PATH;
-    includeDir = "-g -I" + includeDir;
-    if(clBuildProgram(tracingProgram, 1, &ctx->device_id, includeDir.c_str(), NULL, NULL) < 0)
-    {
-        char log[10000];
-        size_t retSize;
-        clGetProgramBuildInfo(tracingProgram, ctx->device_id, CL_PROGRAM_BUILD_LOG, 10000, log, &retSize);
-        printf("error output: %s\n", log);
-
-        throw;
-    }
-
-    cl_kernel raygen = CL_CHECK2(clCreateKernel(tracingProgram, "raygen", &_err));
-    return raygen;
-}
-
-Pipeline CreatePipeline(PipelineCreateInfo pipelineCreateInfo)
+PipelineLayout CreatePipelineLayout(std::vector<DescriptorType> descriptorTypes,
+    std::vector<unsigned int> pushConstantSizes)
 {
-    return pipelineCreateInfo;
+    return {descriptorTypes, pushConstantSizes};
 }
 
 void ReadBuffer(Platform* platform,
@@ -199,6 +333,39 @@ void WriteBuffer(Platform* platform,
         CL_TRUE, offset, size, data, 0, NULL, NULL));
 }
 
+void* MapBuffer(Platform* platform, Buffer handle,
+    size_t size, MapAccess access, size_t offset)
+{
+    CLContext* ctx = platform->clContext;
+    void* mapped = CL_CHECK2(clEnqueueMapBuffer(ctx->commandQueue, handle,
+        CL_TRUE, access, offset, size, 0, NULL, NULL, &_err));
+
+    return mapped;
+}
+
+void UnmapBuffer(Platform* platform, Buffer handle, void* mapped)
+{
+    CLContext* ctx = platform->clContext;
+    cl_event unmapped;
+    CL_CHECK(clEnqueueUnmapMemObject(ctx->commandQueue, handle,
+        mapped, 0, NULL, &unmapped));
+
+    // Command buffers run on the async queue, which is not ordered
+    // with the command queue. Finish here so the buffer is safe to use anywhere.
+    CL_CHECK(clWaitForEvents(1, &unmapped));
+    CL_CHECK(clReleaseEvent(unmapped));
+}
+
+bool HasUnifiedMemory(Platform* platform)
+{
+    return platform->clContext->unifiedMemory;
+}
+
+unsigned int PreferredTextureLayout(Platform* platform)
+{
+    return platform->clContext->cpuDevice ? TEXTURE_LAYOUT_MORTON : TEXTURE_LAYOUT_LINEAR;
+}
+
 void ReadImage(Platform* platform, ImageArray handle,
     unsigned int width, unsigned int height, size_t arrayIndex, void* data)
 {
@@ -228,15 +395,102 @@ void BindPipeline(Platform* platform, Pipeline pipeline)
     platform->activePipeline = pipeline;
 }
 
-void BindDescriptorSet(Platform* platform, DescriptorSet descriptorSet)
+void _setKernelArg(CLContext* ctx, PipelineVariant* variant,
+    cl_uint index, size_t size, const void* value)
 {
-    Pipeline pipeline =  platform->activePipeline;
-    CLContext* ctx = platform->clContext;
+    // Every raygen kernel of the pipeline shares the same layout
+    for (cl_kernel raygen: variant->raygen)
+    {
+        if (raygen)
+            CL_CHECK(clSetKernelArg(raygen, index, size, value));
+    }
+}
 
+void _bindDescriptorSet(CLContext* ctx, Pipeline pipeline,
+    const DescriptorSet& descriptorSet)
+{
+    if (!pipeline)
+    {
+        printf("No pipeline bound before binding descriptor set\n");
+        throw;
+    }
+    WaitForPipeline(pipeline);
+
+    pipeline->boundSet = descriptorSet;
+    PipelineVariant* variant = pipeline->active;
+    variant->boundSet.resize(descriptorSet.size(), nullptr);
     for (int i = 0; i < descriptorSet.size(); i++)
     {
-         CL_CHECK(clSetKernelArg(pipeline.modules[0], i, sizeof(cl_mem), (void *)&(descriptorSet[i])));
+        if (variant->boundSet[i] == descriptorSet[i])
+            continue;
+        _setKernelArg(ctx, variant, i, sizeof(cl_mem), (void *)&(descriptorSet[i]));
+        variant->boundSet[i] = descriptorSet[i];
+    }
+}
+
+void BindDescriptorSet(Platform* platform, DescriptorSet descriptorSet)
+{
+    _bindDescriptorSet(platform->clContext, platform->activePipeline, descriptorSet);
+}
+
+void _pushConstants(CLContext* ctx, Pipeline pipeline,
+    unsigned int rangeIndex, unsigned int size, const void* data)
+{
+    if (!pipeline)
+    {
+        printf("No pipeline bound before pushing constants\n");
+        throw;
+    }
+    WaitForPipeline(pipeline);
+
+    const PipelineLayout& layout = pipeline->createInfo.layout;
+    if (rangeIndex >= layout.pushConstantSizes.size() ||
+        layout.pushConstantSizes[rangeIndex] != size)
+    {
+        printf("Push constant range %u with size %u does not match the pipeline layout\n",
+            rangeIndex, size);
+        throw;
     }
+
+    const char* bytes = (const char*) data;
+    pipeline->pushConstants[rangeIndex].assign(bytes, bytes + size);
+
+    PipelineVariant* variant = pipeline->active;
+    std::vector<char>& pushed = variant->pushConstants[rangeIndex];
+    if (pushed.size() == size && memcmp(pushed.data(), data, size) == 0)
+        return;
+
+    // Push constants follow the descriptors in the kernel argument list
+    _setKernelArg(ctx, variant, layout.descriptorTypes.size() + rangeIndex, size, data);
+    pushed.assign(bytes, bytes + size);
+}
+
+void PushConstants(Platform* platform, unsigned int rangeIndex, unsigned int size, const void* data)
+{
+    _pushConstants(platform->clContext, platform->activePipeline, rangeIndex, size, data);
+}
+
+void _enqueueTraceRays(CLContext* ctx, cl_command_queue queue, Pipeline pipeline,
+    unsigned int raygenGroupIndex, unsigned int width, unsigned int height,
+    cl_uint numWaitEvents, const cl_event* waitEvents, cl_event* event)
+{
+    cl_kernel raygen = _raygenKernel(pipeline, raygenGroupIndex);
+
+    // 2D launch padded to whole tiles; raygen maps ids to pixels with getLaunchID()
+    size_t global_work_size[2] = {
+        (width  + RD_TILE_DIM - 1) / RD_TILE_DIM * RD_TILE_DIM,
+        (height + RD_TILE_DIM - 1) / RD_TILE_DIM * RD_TILE_DIM
+    };
+    size_t local_work_size[2] = {RD_TILE_DIM, RD_TILE_DIM};
+
+    // One tile per work group if the kernel allows it, otherwise let the driver choose.
+    size_t maxGroupSize = 0;
+    CL_CHECK(clGetKernelWorkGroupInfo(raygen, ctx->device_id, CL_KERNEL_WORK_GROUP_SIZE,
+        sizeof(size_t), &maxGroupSize, NULL));
+    const size_t* local = maxGroupSize >= RD_TILE_DIM * RD_TILE_DIM ? local_work_size : NULL;
+
+    CL_CHECK(clEnqueueNDRangeKernel(queue, raygen, 2, NULL,
+        global_work_size, local, numWaitEvents, waitEvents, event));
 }
 
 void TraceRays(Platform* platform,
@@ -247,16 +501,11 @@ void TraceRays(Platform* platform,
     unsigned int height)
 {
     // printf("Execute the kernel\n");
-    size_t global_work_size[1] = {width * height};
-    size_t local_work_size[1] = {1};
     auto time_start = std::chrono::high_resolution_clock::now();
-
-    cl_kernel raygen = platform->activePipeline.modules[0];
     CLContext* ctx = platform->clContext;
 
-
-    CL_CHECK(clEnqueueNDRangeKernel(ctx->commandQueue, raygen, 1, NULL,
-        global_work_size, local_work_size, 0, NULL, NULL));
+    _enqueueTraceRays(ctx, ctx->commandQueue, platform->activePipeline,
+        raygenGroupIndex, width, height, 0, NULL, NULL);
 
     CL_CHECK(clFinish(ctx->commandQueue));
     
@@ -266,6 +515,238 @@ void TraceRays(Platform* platform,
     fflush(stdout);    
 }
 
+enum CommandType
+{
+    CMD_WRITE_BUFFER,
+    CMD_READ_BUFFER,
+    CMD_WRITE_IMAGE,
+    CMD_BIND_PIPELINE,
+    CMD_BIND_DESCRIPTOR_SET,
+    CMD_PUSH_CONSTANTS,
+    CMD_TRACE_RAYS
+};
+
+struct Command
+{
+    CommandType type;
+
+    cl_mem handle;
+    size_t size;
+    size_t offset;
+    void* data;
+
+    unsigned int width;
+    unsigned int height;
+    size_t arrayIndex;
+    unsigned int raygenGroupIndex;
+
+    Pipeline pipeline;
+    DescriptorSet descriptorSet;
+
+    unsigned int rangeIndex;
+    std::vector<char> constants;
+};
+
+struct _CommandBuffer
+{
+    Platform* platform;
+    std::vector<Command> commands;
+};
+
+CommandBuffer CreateCommandBuffer(Platform* platform)
+{
+    _CommandBuffer* commandBuffer = new _CommandBuffer();
+    commandBuffer->platform = platform;
+    return commandBuffer;
+}
+
+void DestroyCommandBuffer(CommandBuffer commandBuffer)
+{
+    delete commandBuffer;
+}
+
+void ResetCommandBuffer(CommandBuffer commandBuffer)
+{
+    commandBuffer->commands.clear();
+}
+
+void CmdWriteBuffer(CommandBuffer commandBuffer, Buffer handle,
+    size_t size, void* data, size_t offset)
+{
+    Command cmd = {};
+    cmd.type    = CMD_WRITE_BUFFER;
+    cmd.handle  = handle;
+    cmd.size    = size;
+    cmd.offset  = offset;
+    cmd.data    = data;
+    commandBuffer->commands.push_back(cmd);
+}
+
+void CmdReadBuffer(CommandBuffer commandBuffer, Buffer handle,
+    size_t size, void* data, size_t offset)
+{
+    Command cmd = {};
+    cmd.type    = CMD_READ_BUFFER;
+    cmd.handle  = handle;
+    cmd.size    = size;
+    cmd.offset  = offset;
+    cmd.data    = data;
+    commandBuffer->commands.push_back(cmd);
+}
+
+void CmdWriteImage(CommandBuffer commandBuffer, ImageArray handle,
+    unsigned int width, unsigned int height, size_t arrayIndex, void* data)
+{
+    Command cmd = {};
+    cmd.type       = CMD_WRITE_IMAGE;
+    cmd.handle     = handle;
+    cmd.width      = width;
+    cmd.height     = height;
+    cmd.arrayIndex = arrayIndex;
+    cmd.data       = data;
+    commandBuffer->commands.push_back(cmd);
+}
+
+void CmdBindPipeline(CommandBuffer commandBuffer, Pipeline pipeline)
+{
+    Command cmd = {};
+    cmd.type     = CMD_BIND_PIPELINE;
+    cmd.pipeline = pipeline;
+    commandBuffer->commands.push_back(cmd);
+}
+
+void CmdBindDescriptorSet(CommandBuffer commandBuffer, DescriptorSet descriptorSet)
+{
+    Command cmd = {};
+    cmd.type          = CMD_BIND_DESCRIPTOR_SET;
+    cmd.descriptorSet = descriptorSet;
+    commandBuffer->commands.push_back(cmd);
+}
+
+void CmdPushConstants(CommandBuffer commandBuffer,
+    unsigned int rangeIndex, unsigned int size, const void* data)
+{
+    const char* bytes = (const char*) data;
+
+    Command cmd = {};
+    cmd.type       = CMD_PUSH_CONSTANTS;
+    cmd.rangeIndex = rangeIndex;
+    cmd.constants.assign(bytes, bytes + size);
+    commandBuffer->commands.push_back(cmd);
+}
+
+void CmdTraceRays(CommandBuffer commandBuffer,
+    unsigned int raygenGroupIndex,
+    unsigned int missGroupIndex,
+    unsigned int hitGroupIndex,
+    unsigned int width,
+    unsigned int height)
+{
+    Command cmd = {};
+    cmd.type   = CMD_TRACE_RAYS;
+    cmd.width  = width;
+    cmd.height = height;
+    cmd.raygenGroupIndex = raygenGroupIndex;
+    commandBuffer->commands.push_back(cmd);
+}
+
+Fence SubmitCommandBuffer(Platform* platform, CommandBuffer commandBuffer,
+    const std::vector<Fence>& waitFences)
+{
+    CLContext* ctx = platform->clContext;
+    cl_command_queue queue = ctx->asyncQueue;
+
+    // Pipeline state starts from what is bound on the platform
+    Pipeline pipeline = platform->activePipeline;
+
+    // Every command waits on the previous one, the first on the wait fences
+    std::vector<cl_event> waitList = waitFences;
+    cl_event prevEvent = NULL;
+
+    for (const Command& cmd: commandBuffer->commands)
+    {
+        cl_uint numWait = waitList.size();
+        const cl_event* wait = numWait? waitList.data(): NULL;
+        cl_event event = NULL;
+
+        switch (cmd.type)
+        {
+        case CMD_WRITE_BUFFER:
+            CL_CHECK(clEnqueueWriteBuffer(queue, cmd.handle, CL_FALSE,
+                cmd.offset, cmd.size, cmd.data, numWait, wait, &event));
+            break;
+        case CMD_READ_BUFFER:
+            CL_CHECK(clEnqueueReadBuffer(queue, cmd.handle, CL_FALSE,
+                cmd.offset, cmd.size, cmd.data, numWait, wait, &event));
+            break;
+        case CMD_WRITE_IMAGE:
+        {
+            size_t origin[3] = {0, 0, cmd.arrayIndex};
+            size_t region[3] = {cmd.width, cmd.height, 1};
+            CL_CHECK(clEnqueueWriteImage(queue, cmd.handle, CL_FALSE,
+                origin, region, 0, 0, cmd.data, numWait, wait, &event));
+            break;
+        }
+        case CMD_BIND_PIPELINE:
+            pipeline = cmd.pipeline;
+            continue;
+        case CMD_BIND_DESCRIPTOR_SET:
+            // Arguments are captured by the kernel at enqueue time
+            _bindDescriptorSet(ctx, pipeline, cmd.descriptorSet);
+            continue;
+        case CMD_PUSH_CONSTANTS:
+            _pushConstants(ctx, pipeline, cmd.rangeIndex,
+                cmd.constants.size(), cmd.constants.data());
+            continue;
+        case CMD_TRACE_RAYS:
+            _enqueueTraceRays(ctx, queue, pipeline, cmd.raygenGroupIndex,
+                cmd.width, cmd.height, numWait, wait, &event);
+            break;
+        }
+
+        if (prevEvent)
+            CL_CHECK(clReleaseEvent(prevEvent));
+        prevEvent = event;
+        waitList = {event};
+    }
+
+    cl_event fence;
+    CL_CHECK(clEnqueueMarkerWithWaitList(queue, waitList.size(),
+        waitList.empty()? NULL: waitList.data(), &fence));
+    if (prevEvent)
+        CL_CHECK(clReleaseEvent(prevEvent));
+
+    // Make sure the work starts without anyone waiting on it
+    CL_CHECK(clFlush(queue));
+    return fence;
+}
+
+bool GetFenceStatus(Platform* platform, Fence fence)
+{
+    CLContext* ctx = platform->clContext;
+    cl_int status;
+    CL_CHECK(clGetEventInfo(fence, CL_EVENT_COMMAND_EXECUTION_STATUS,
+        sizeof(cl_int), &status, NULL));
+    if (status < 0)
+    {
+        printf("OpenCL Error: fence completed with error %d!\n", (int)status);
+        ctx->Cleanup();
+        exit(-1);
+    }
+    return status == CL_COMPLETE;
+}
+
+void WaitForFence(Platform* platform, Fence fence)
+{
+    CLContext* ctx = platform->clContext;
+    CL_CHECK(clWaitForEvents(1, &fence));
+}
+
+void DestroyFence(Fence fence)
+{
+    clReleaseEvent(fence);
+}
+
 cl_mem _buildAccelStruct(CLContext* ctx,
     const std::vector<DeviceBVHNode>& nodeList,
     const std::vector<unsigned int>& faceRefList,
@@ -318,12 +799,14 @@ cl_mem _buildAccelStruct(CLContext* ctx,
 void _buildBottomAccelStruct(CLContext* ctx,
     const std::vector<DeviceBVHNode>& nodeList,
     const std::vector<DeviceTriangle>& faceList,
-    const std::vector<Vec3>& vertexList,
+    const MeshView& mesh,
     std::vector<char>& data)
 {
+    const Vec3* vertexList = mesh.vertexData;
+    bool external = mesh.vertexBufferStride != 0;
     unsigned int nodeListSize = nodeList.size() * sizeof(DeviceBVHNode),
                  faceListSize = faceList.size() * sizeof(DeviceTriangle),
-                 vertexListSize = vertexList.size() * sizeof(DeviceVertex);
+                 vertexListSize = external ? 0 : mesh.vertexCount * sizeof(DeviceVertex);
     
     // header size + data size
     unsigned int bufferSizeByte = sizeof(AccelStructBottom) +
@@ -335,7 +818,7 @@ void _buildBottomAccelStruct(CLContext* ctx,
     printf("Triangle size: %ld\n\t %ld elements\n\t array bytes: %u\n",
         sizeof(DeviceTriangle), faceList.size(), faceListSize);
     printf("Vertex size: %ld\n\t %ld elements\n\t array bytes: %u\n",
-        sizeof(DeviceVertex), vertexList.size(), vertexListSize);
+        sizeof(DeviceVertex), mesh.vertexCount, vertexListSize);
     printf("AccelStruct header size: %lu\n", sizeof(AccelStructBottom));
     printf("Total AccelStruct data size: %u\n", bufferSizeByte);
 #endif
@@ -347,14 +830,27 @@ void _buildBottomAccelStruct(CLContext* ctx,
         .nodeByteOffset = sizeof(AccelStructBottom),
         .faceByteOffset = (unsigned int) sizeof(AccelStructBottom) + nodeListSize,
         .vertexOffset   = (unsigned int) sizeof(AccelStructBottom) + nodeListSize + faceListSize,
+        .vertexStride   = sizeof(DeviceVertex) / sizeof(float),
+        .vertexExternal = external,
+        ._0 = 0, ._1 = 0
     };
 
+    // Shared positions are only referenced, the scene vertex buffer holds them
+    if (external)
+    {
+        accelStruct.vertexOffset = mesh.vertexBufferOffset;
+        accelStruct.vertexStride = mesh.vertexBufferStride;
+    }
+
     char* ptr = data.data();
     memcpy(ptr, &accelStruct, sizeof(AccelStructBottom));
     memcpy(ptr + accelStruct.nodeByteOffset, nodeList.data(), nodeListSize);
     memcpy(ptr + accelStruct.faceByteOffset, faceList.data(), faceListSize);
+    if (external)
+        return;
+
     DeviceVertex* pVertex = (DeviceVertex*)(ptr + accelStruct.vertexOffset);
-    for (int i = 0; i < vertexList.size(); i++)
+    for (size_t i = 0; i < mesh.vertexCount; i++)
     {
         DeviceVertex* ptr = pVertex + i;
         ptr->x = vertexList[i].x;
@@ -363,12 +859,13 @@ void _buildBottomAccelStruct(CLContext* ctx,
     }
 }
 
-TopAccelStruct _buildTopAccelStruct(CLContext* ctx,
+TopAccelStruct _buildTopAccelStruct(Platform* platform,
     const std::vector<DeviceBVHNode>& nodeList,
     const std::vector<DeviceInstance>& deviceInstList,
     const std::vector<Instance>& instList,
     const std::map<BottomAccelStruct, unsigned int>& instOffsetMap)
 {
+    CLContext* ctx = platform->clContext;
     unsigned int nodeListSize = nodeList.size() * sizeof(DeviceBVHNode),
                  deviceInstListSize = deviceInstList.size() * sizeof(DeviceInstance),
                  instanceTotalSize = 0;
@@ -404,78 +901,178 @@ TopAccelStruct _buildTopAccelStruct(CLContext* ctx,
     };
 
 
-    CL_CHECK(clEnqueueWriteBuffer(ctx->commandQueue, accelStructBuf, CL_TRUE,
-        0, sizeof(accelStruct), &accelStruct,
-        0, NULL, NULL));
-    CL_CHECK(clEnqueueWriteBuffer(ctx->commandQueue, accelStructBuf, CL_TRUE,
-        accelStruct.nodeByteOffset, nodeListSize, nodeList.data(),
-        0, NULL, NULL));
-    CL_CHECK(clEnqueueWriteBuffer(ctx->commandQueue, accelStructBuf, CL_TRUE,
-        accelStruct.instByteOffset, deviceInstListSize, deviceInstList.data(),
-        0, NULL, NULL));
+    // Many small bottom level blobs, batch them through a staging ring no larger than the TLAS
+    UploadManager uploader = CreateUploadManager(platform,
+        std::min((size_t)bufferSizeByte, (size_t)RD_STAGING_RING_SIZE));
+
+    UploadBuffer(uploader, accelStructBuf,
+        sizeof(accelStruct), &accelStruct, 0);
+    UploadBuffer(uploader, accelStructBuf,
+        nodeListSize, nodeList.data(), accelStruct.nodeByteOffset);
+    UploadBuffer(uploader, accelStructBuf,
+        deviceInstListSize, deviceInstList.data(), accelStruct.instByteOffset);
     
     for (auto &e: instOffsetMap)
     {
-        CL_CHECK(clEnqueueWriteBuffer(ctx->commandQueue, accelStructBuf, CL_TRUE,
-            e.second, e.first->data.size(), e.first->data.data(),
-            0, NULL, NULL));
+        UploadBuffer(uploader, accelStructBuf,
+            e.first->data.size(), e.first->data.data(), e.second);
     }
 
+    DestroyUploadManager(uploader);
     return accelStructBuf;
 }
 
 
-void TopAccelStructToFile(Platform* platform,
-    TopAccelStruct accelStruct, const char* path)
+void ReadTopAccelStruct(Platform* platform,
+    TopAccelStruct accelStruct, std::vector<char>& data)
 {
     AccelStructTop header;
     ReadBuffer(platform, accelStruct, sizeof(AccelStructTop), &header);
 
-    unsigned char* buffer = (unsigned char*) malloc(header.totalBufferSize);
-    ReadBuffer(platform, accelStruct, header.totalBufferSize, buffer);
+    data.resize(header.totalBufferSize);
+    ReadBuffer(platform, accelStruct, header.totalBufferSize, data.data());
+}
 
-    FILE* fp = fopen(path, "w");
+struct AccelStructFileHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t dataSize; // bytes of AS data following the header
+    uint64_t checksum; // FNV-1a 64 of the AS data
+};
 
-    unsigned int byteWritten = 0;
-    while(header.totalBufferSize - byteWritten > 0)
+bool TopAccelStructToFile(Platform* platform,
+    TopAccelStruct accelStruct, const char* path)
+{
+    CLContext* ctx = platform->clContext;
+
+    AccelStructTop top;
+    ReadBuffer(platform, accelStruct, sizeof(AccelStructTop), &top);
+
+    // Written aside and renamed into place, readers never see a partial file
+    std::string tmpPath = TempCachePath(path);
+    FILE* fp = fopen(tmpPath.c_str(), "wb");
+    if (fp == nullptr)
     {
-        byteWritten += fwrite(
-            buffer + byteWritten, 1,
-            header.totalBufferSize - byteWritten, fp);
+        printf("Failed to open %s for writing\n", tmpPath.c_str());
+        return false;
     }
 
-    free(buffer);
+    // The checksum is patched in once all chunks went through
+    AccelStructFileHeader header = {
+        .magic    = ACCEL_FILE_MAGIC,
+        .version  = ACCEL_FILE_VERSION,
+        .dataSize = top.totalBufferSize,
+        .checksum = FNV_OFFSET_BASIS
+    };
+    bool ok = fwrite(&header, sizeof(header), 1, fp) == 1;
+
+    // Double buffered: the next chunk is read back while the previous one is written
+    std::vector<char> chunks[2];
+    chunks[0].resize(std::min<uint64_t>(ACCEL_FILE_CHUNK_SIZE, header.dataSize));
+    chunks[1].resize(chunks[0].size());
+    cl_event events[2];
+
+    auto enqueueRead = [&](uint64_t offset, int slot) {
+        size_t size = std::min<uint64_t>(ACCEL_FILE_CHUNK_SIZE, header.dataSize - offset);
+        CL_CHECK(clEnqueueReadBuffer(ctx->commandQueue, accelStruct, CL_FALSE,
+            offset, size, chunks[slot].data(), 0, NULL, &events[slot]));
+    };
+
+    if (header.dataSize > 0)
+        enqueueRead(0, 0);
+
+    for (uint64_t offset = 0, slot = 0; offset < header.dataSize;
+        offset += ACCEL_FILE_CHUNK_SIZE, slot ^= 1)
+    {
+        if (offset + ACCEL_FILE_CHUNK_SIZE < header.dataSize)
+            enqueueRead(offset + ACCEL_FILE_CHUNK_SIZE, slot ^ 1);
+
+        CL_CHECK(clWaitForEvents(1, &events[slot]));
+        CL_CHECK(clReleaseEvent(events[slot]));
+
+        size_t size = std::min<uint64_t>(ACCEL_FILE_CHUNK_SIZE, header.dataSize - offset);
+        header.checksum = HashBytes(chunks[slot].data(), size, header.checksum);
+        ok = ok && fwrite(chunks[slot].data(), 1, size, fp) == size;
+    }
+
+    ok = ok && fseek(fp, 0, SEEK_SET) == 0 &&
+        fwrite(&header, sizeof(header), 1, fp) == 1;
+    ok = fclose(fp) == 0 && ok;
+    ok = ok && rename(tmpPath.c_str(), path) == 0;
+
+    if (!ok)
+    {
+        printf("Failed to write AccelStruct file %s\n", path);
+        remove(tmpPath.c_str());
+    }
+    return ok;
 }
 
-void FileToTopAccelStruct(Platform* platform,
+bool FileToTopAccelStruct(Platform* platform,
     const char* path, TopAccelStruct* accelStruct)
 {
     CLContext* ctx = platform->clContext;
-    AccelStructTop header;
 
-    FILE* fp = fopen(path, "r");
-    unsigned int byteRead = fread(&header, 1, sizeof(AccelStructTop), fp);
-    if (byteRead != sizeof(AccelStructTop))
-        throw;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return false;
 
-    cl_mem accelStructBuf = CL_CHECK2(clCreateBuffer(
-        ctx->context, CL_MEM_READ_WRITE, header.totalBufferSize, NULL, &_err));
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(AccelStructFileHeader))
+    {
+        close(fd);
+        printf("AccelStruct file %s is truncated\n", path);
+        return false;
+    }
+
+    void* mapping = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED)
+        return false;
 
-    rewind(fp);
-    unsigned char* buffer = (unsigned char*) malloc(header.totalBufferSize);
+    const AccelStructFileHeader* header = (const AccelStructFileHeader*) mapping;
+    const char* data = (const char*) mapping + sizeof(AccelStructFileHeader);
 
-    byteRead = 0;
-    while (header.totalBufferSize - byteRead > 0)
+    if (header->magic != ACCEL_FILE_MAGIC || header->version != ACCEL_FILE_VERSION ||
+        header->dataSize < sizeof(AccelStructTop) ||
+        header->dataSize != st.st_size - sizeof(AccelStructFileHeader))
     {
-        byteRead += fread(
-            buffer + byteRead, 1,
-            header.totalBufferSize - byteRead, fp);
+        printf("AccelStruct file %s has an unknown format or version\n", path);
+        munmap(mapping, st.st_size);
+        return false;
     }
 
-    WriteBuffer(platform, accelStructBuf, header.totalBufferSize, buffer, 0);
-    free(buffer);
+    // Pages are faulted in chunk by chunk, readahead keeps the disk busy meanwhile
+    madvise(mapping, st.st_size, MADV_SEQUENTIAL);
+
+    cl_mem accelStructBuf = CL_CHECK2(clCreateBuffer(
+        ctx->context, CL_MEM_READ_WRITE, header->dataSize, NULL, &_err));
+
+    // Chunks are staged through the ring, so reading the next chunk from disk
+    // overlaps the transfer of the previous ones
+    UploadManager uploader = CreateUploadManager(platform);
+    uint64_t checksum = FNV_OFFSET_BASIS;
+    for (uint64_t offset = 0; offset < header->dataSize; offset += ACCEL_FILE_CHUNK_SIZE)
+    {
+        size_t size = std::min<uint64_t>(ACCEL_FILE_CHUNK_SIZE, header->dataSize - offset);
+        checksum = HashBytes(data + offset, size, checksum);
+        UploadBuffer(uploader, accelStructBuf, size, data + offset, offset);
+    }
+    DestroyUploadManager(uploader);
+
+    bool valid = checksum == header->checksum;
+    munmap(mapping, st.st_size);
+
+    if (!valid)
+    {
+        printf("AccelStruct file %s is corrupt\n", path);
+        CL_CHECK(clReleaseMemObject(accelStructBuf));
+        return false;
+    }
 
     *accelStruct = accelStructBuf;
+    return true;
 }
 
 } // namespace RD
@@ -0,0 +1,326 @@
+#include "texture.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cstring>
+
+namespace RD
+{
+
+unsigned int TextureLevelCount(unsigned int width, unsigned int height)
+{
+    unsigned int levelCount = 1;
+    for (unsigned int size = std::max(width, height); size > 1; size >>= 1)
+        levelCount++;
+    return std::min(levelCount, (unsigned int)TEXTURE_MAX_LEVELS);
+}
+
+void BuildMipChain(unsigned int width, unsigned int height,
+    const unsigned char* rgba, std::vector<unsigned char>& levels)
+{
+    levels.assign(rgba, rgba + (size_t)width * height * CHANNEL);
+
+    size_t srcOffset = 0;
+    unsigned int levelCount = TextureLevelCount(width, height);
+    for (unsigned int level = 1; level < levelCount; level++)
+    {
+        unsigned int srcWidth  = std::max(width  >> (level - 1), 1u);
+        unsigned int srcHeight = std::max(height >> (level - 1), 1u);
+        unsigned int dstWidth  = std::max(width  >> level, 1u);
+        unsigned int dstHeight = std::max(height >> level, 1u);
+
+        size_t dstOffset = levels.size();
+        levels.resize(dstOffset + (size_t)dstWidth * dstHeight * CHANNEL);
+        const unsigned char* src = levels.data() + srcOffset;
+        unsigned char* dst = levels.data() + dstOffset;
+
+        // 2x2 box filter, the last row or column of odd sizes is reused
+        for (unsigned int y = 0; y < dstHeight; y++)
+        {
+            unsigned int y0 = std::min(2 * y, srcHeight - 1);
+            unsigned int y1 = std::min(2 * y + 1, srcHeight - 1);
+            for (unsigned int x = 0; x < dstWidth; x++)
+            {
+                unsigned int x0 = std::min(2 * x, srcWidth - 1);
+                unsigned int x1 = std::min(2 * x + 1, srcWidth - 1);
+                for (unsigned int c = 0; c < CHANNEL; c++)
+                {
+                    unsigned int sum =
+                        src[((size_t)y0 * srcWidth + x0) * CHANNEL + c] +
+                        src[((size_t)y0 * srcWidth + x1) * CHANNEL + c] +
+                        src[((size_t)y1 * srcWidth + x0) * CHANNEL + c] +
+                        src[((size_t)y1 * srcWidth + x1) * CHANNEL + c];
+                    dst[((size_t)y * dstWidth + x) * CHANNEL + c] = (sum + 2) / 4;
+                }
+            }
+        }
+        srcOffset = dstOffset;
+    }
+}
+
+// Source channel feeding a stored channel, the first sampled channel selecting it
+unsigned int _sourceChannel(unsigned int swizzle, unsigned int stored)
+{
+    for (unsigned int channel = 0; channel < CHANNEL; channel++)
+        if (((swizzle >> (4 * channel)) & 0xf) == stored)
+            return channel;
+    return stored;
+}
+
+// Texels of the 4x4 block at <bx, by>, edges repeat the last row or column
+void _gatherBlock(const unsigned char* level, unsigned int width, unsigned int height,
+    unsigned int bx, unsigned int by, unsigned char block[16][CHANNEL])
+{
+    for (unsigned int i = 0; i < 16; i++)
+    {
+        unsigned int x = std::min(bx * 4 + i % 4, width - 1);
+        unsigned int y = std::min(by * 4 + i / 4, height - 1);
+        memcpy(block[i], level + ((size_t)y * width + x) * CHANNEL, CHANNEL);
+    }
+}
+
+void _encodeBC4(const unsigned char block[16][CHANNEL], unsigned int channel, unsigned char* out)
+{
+    unsigned char lo = 255, hi = 0;
+    for (unsigned int i = 0; i < 16; i++)
+    {
+        lo = std::min(lo, block[i][channel]);
+        hi = std::max(hi, block[i][channel]);
+    }
+
+    // 8 value mode: index 0 is hi, 1 is lo, 2..7 step from hi towards lo
+    uint64_t bits = (uint64_t)hi | (uint64_t)lo << 8;
+    for (unsigned int i = 0; hi > lo && i < 16; i++)
+    {
+        unsigned int step = ((hi - block[i][channel]) * 7 + (hi - lo) / 2) / (hi - lo);
+        unsigned int index = step == 0 ? 0 : step == 7 ? 1 : step + 1;
+        bits |= (uint64_t)index << (16 + 3 * i);
+    }
+    memcpy(out, &bits, 8);
+}
+
+unsigned int _pack565(const float color[3])
+{
+    return (unsigned int)(color[0] * 31.0f / 255.0f + 0.5f) << 11 |
+        (unsigned int)(color[1] * 63.0f / 255.0f + 0.5f) << 5 |
+        (unsigned int)(color[2] * 31.0f / 255.0f + 0.5f);
+}
+
+void _unpack565(unsigned int c, float color[3])
+{
+    color[0] = ((c >> 11) & 31) * 255.0f / 31.0f;
+    color[1] = ((c >> 5) & 63) * 255.0f / 63.0f;
+    color[2] = (c & 31) * 255.0f / 31.0f;
+}
+
+void _encodeBC1(const unsigned char block[16][CHANNEL], const unsigned int channels[3],
+    unsigned char* out)
+{
+    // Bounding box endpoints, inset by 1/16 of the range to cut the error at the ends
+    float lo[3], hi[3];
+    for (unsigned int c = 0; c < 3; c++)
+    {
+        lo[c] = 255.0f; hi[c] = 0.0f;
+        for (unsigned int i = 0; i < 16; i++)
+        {
+            lo[c] = std::min(lo[c], (float)block[i][channels[c]]);
+            hi[c] = std::max(hi[c], (float)block[i][channels[c]]);
+        }
+        float inset = (hi[c] - lo[c]) / 16.0f;
+        lo[c] += inset;
+        hi[c] -= inset;
+    }
+
+    unsigned int c0 = _pack565(hi), c1 = _pack565(lo);
+    if (c0 < c1)
+        std::swap(c0, c1);
+
+    // 4 color mode needs c0 > c1, equal endpoints leave every index at 0
+    float palette[4][3];
+    _unpack565(c0, palette[0]);
+    _unpack565(c1, palette[1]);
+    for (unsigned int c = 0; c < 3; c++)
+    {
+        palette[2][c] = (2.0f * palette[0][c] + palette[1][c]) / 3.0f;
+        palette[3][c] = (palette[0][c] + 2.0f * palette[1][c]) / 3.0f;
+    }
+
+    uint32_t indices = 0;
+    for (unsigned int i = 0; c0 != c1 && i < 16; i++)
+    {
+        unsigned int best = 0;
+        float bestError = FLT_MAX;
+        for (unsigned int p = 0; p < 4; p++)
+        {
+            float error = 0.0f;
+            for (unsigned int c = 0; c < 3; c++)
+            {
+                float d = block[i][channels[c]] - palette[p][c];
+                error += d * d;
+            }
+            if (error < bestError)
+            {
+                bestError = error;
+                best = p;
+            }
+        }
+        indices |= best << (2 * i);
+    }
+
+    uint32_t endpoints = c0 | c1 << 16;
+    memcpy(out, &endpoints, 4);
+    memcpy(out + 4, &indices, 4);
+}
+
+// Element is a texel for RGBA8 and a 4x4 block for the BC formats
+unsigned int _elementSize(unsigned int format)
+{
+    switch (format)
+    {
+    case TEXTURE_FORMAT_BC1:
+    case TEXTURE_FORMAT_BC4: return 8;
+    case TEXTURE_FORMAT_BC5: return 16;
+    default: return CHANNEL;
+    }
+}
+
+unsigned int _elementGrid(unsigned int format, unsigned int size)
+{
+    return format == TEXTURE_FORMAT_RGBA8 ? size : (size + 3) / 4;
+}
+
+// Same as textureElementIndex() in shader/texture.cl
+unsigned int _morton8(unsigned int x, unsigned int y)
+{
+    x = (x | (x << 2)) & 0x33; x = (x | (x << 1)) & 0x55;
+    y = (y | (y << 2)) & 0x33; y = (y | (y << 1)) & 0x55;
+    return x | (y << 1);
+}
+
+size_t _elementIndex(unsigned int layout, unsigned int x, unsigned int y, unsigned int gridWidth)
+{
+    if (layout == TEXTURE_LAYOUT_LINEAR)
+        return (size_t)y * gridWidth + x;
+
+    size_t tilesX = (gridWidth + 7) / 8;
+    return ((y / 8) * tilesX + x / 8) * 64 + _morton8(x % 8, y % 8);
+}
+
+size_t _levelSize(const TextureDesc& desc, unsigned int width, unsigned int height)
+{
+    size_t gridWidth = _elementGrid(desc.format, width);
+    size_t gridHeight = _elementGrid(desc.format, height);
+
+    // Morton levels are padded to whole tiles
+    if (desc.layout == TEXTURE_LAYOUT_MORTON)
+    {
+        gridWidth = (gridWidth + 7) / 8 * 8;
+        gridHeight = (gridHeight + 7) / 8 * 8;
+    }
+    return gridWidth * gridHeight * _elementSize(desc.format);
+}
+
+void _encodeElement(const unsigned char* level, unsigned int width, unsigned int height,
+    unsigned int x, unsigned int y, const TextureDesc& desc, unsigned char* out)
+{
+    if (desc.format == TEXTURE_FORMAT_RGBA8)
+    {
+        memcpy(out, level + ((size_t)y * width + x) * CHANNEL, CHANNEL);
+        return;
+    }
+
+    unsigned int channels[3] = {
+        _sourceChannel(desc.swizzle, TEXTURE_CHANNEL_R),
+        _sourceChannel(desc.swizzle, TEXTURE_CHANNEL_G),
+        _sourceChannel(desc.swizzle, TEXTURE_CHANNEL_B)
+    };
+
+    unsigned char block[16][CHANNEL];
+    _gatherBlock(level, width, height, x, y, block);
+    switch (desc.format)
+    {
+    case TEXTURE_FORMAT_BC1:
+        _encodeBC1(block, channels, out);
+        break;
+    case TEXTURE_FORMAT_BC4:
+        _encodeBC4(block, channels[0], out);
+        break;
+    case TEXTURE_FORMAT_BC5:
+        _encodeBC4(block, channels[0], out);
+        _encodeBC4(block, channels[1], out + 8);
+        break;
+    }
+}
+
+void _encodeLevel(const unsigned char* level, unsigned int width, unsigned int height,
+    const TextureDesc& desc, unsigned char* out)
+{
+    unsigned int gridWidth = _elementGrid(desc.format, width);
+    unsigned int gridHeight = _elementGrid(desc.format, height);
+    unsigned int elementSize = _elementSize(desc.format);
+
+    for (unsigned int y = 0; y < gridHeight; y++)
+        for (unsigned int x = 0; x < gridWidth; x++)
+            _encodeElement(level, width, height, x, y, desc,
+                out + _elementIndex(desc.layout, x, y, gridWidth) * elementSize);
+}
+
+size_t TextureLevelBytes(const TextureInfo& info, unsigned int level)
+{
+    TextureDesc desc;
+    desc.format = info.format;
+    desc.layout = info.layout;
+    return _levelSize(desc, std::max(info.width >> level, 1u), std::max(info.height >> level, 1u));
+}
+
+unsigned int AppendTexture(std::vector<TextureInfo>& infos, std::vector<unsigned char>& data,
+    unsigned int width, unsigned int height, const std::vector<unsigned char>& levels,
+    const TextureDesc& desc)
+{
+    TextureInfo info = {};
+    info.width = width;
+    info.height = height;
+    info.levelCount = TextureLevelCount(width, height);
+    info.format = desc.format;
+    info.swizzle = desc.swizzle;
+    info.layout = desc.layout;
+    info.addressMode = desc.addressMode;
+    info.filterMode = desc.filterMode;
+
+    size_t base = (data.size() + TEXTURE_ALIGNMENT - 1) / TEXTURE_ALIGNMENT * TEXTURE_ALIGNMENT;
+    size_t offset = base, levelsSize = 0;
+    for (unsigned int level = 0; level < info.levelCount; level++)
+    {
+        unsigned int levelWidth = std::max(width >> level, 1u);
+        unsigned int levelHeight = std::max(height >> level, 1u);
+        info.levelOffset[level] = offset;
+        offset += _levelSize(desc, levelWidth, levelHeight);
+        levelsSize += (size_t)levelWidth * levelHeight * CHANNEL;
+    }
+
+    if (levelsSize != levels.size())
+    {
+        printf("Texture levels do not match a %ux%u mip chain\n", width, height);
+        throw;
+    }
+    if (offset > UINT32_MAX)
+    {
+        printf("Texture table passes 4 GB, texel offsets are 32-bit\n");
+        throw;
+    }
+
+    data.resize(offset, 0);
+    const unsigned char* level = levels.data();
+    for (unsigned int i = 0; i < info.levelCount; i++)
+    {
+        unsigned int levelWidth = std::max(width >> i, 1u);
+        unsigned int levelHeight = std::max(height >> i, 1u);
+        _encodeLevel(level, levelWidth, levelHeight, desc, data.data() + info.levelOffset[i]);
+        level += (size_t)levelWidth * levelHeight * CHANNEL;
+    }
+
+    infos.push_back(info);
+    return infos.size() - 1;
+}
+
+} // namespace RD
@@ -0,0 +1,10 @@
+#pragma once
+#include "radiance.h"
+
+namespace RD
+{
+
+// Bytes taken by one level of a texture in the texel buffer, padding included
+size_t TextureLevelBytes(const TextureInfo& info, unsigned int level);
+
+} // namespace RD
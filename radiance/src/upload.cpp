@@ -0,0 +1,241 @@
+#include "radiance.h"
+
+#include <algorithm>
+#include <deque>
+#include <cstring>
+
+namespace RD
+{
+
+#define STAGING_ALIGNMENT 64
+
+// A range of the ring buffer used by one in-flight transfer
+struct StagingSegment
+{
+    size_t begin;
+    size_t end;
+    cl_event event;
+};
+
+struct _UploadManager
+{
+    Platform* platform;
+
+    cl_mem staging;        // created on first use, direct mapped buffers never need it
+    unsigned char* mapped; // pinned host memory backing the staging buffer
+    size_t size;
+
+    size_t head; // next free byte
+    std::deque<StagingSegment> inFlight; // oldest first
+
+    // Unified memory devices: buffers are written in place through a mapping,
+    // the staging hop would only add a second copy.
+    bool directMap;
+    std::vector<cl_event> unmaps;
+};
+
+UploadManager CreateUploadManager(Platform* platform, size_t ringSize)
+{
+    CLContext* ctx = platform->clContext;
+
+    _UploadManager* uploader = new _UploadManager();
+    uploader->platform = platform;
+    uploader->size = std::max(ringSize, (size_t)4 * STAGING_ALIGNMENT); // room for 4 chunks
+    uploader->head = 0;
+    uploader->directMap = ctx->unifiedMemory;
+    uploader->staging = NULL;
+    uploader->mapped = nullptr;
+    return uploader;
+}
+
+void _createStaging(UploadManager uploader)
+{
+    CLContext* ctx = uploader->platform->clContext;
+    uploader->staging = CL_CHECK2(clCreateBuffer(ctx->context,
+        CL_MEM_READ_ONLY | CL_MEM_ALLOC_HOST_PTR, uploader->size, NULL, &_err));
+
+    // Stays mapped for the lifetime of the manager, only used as a host pointer.
+    uploader->mapped = (unsigned char*) CL_CHECK2(clEnqueueMapBuffer(ctx->commandQueue,
+        uploader->staging, CL_TRUE, CL_MAP_WRITE, 0, uploader->size, 0, NULL, NULL, &_err));
+}
+
+void _retireOldest(UploadManager uploader)
+{
+    CLContext* ctx = uploader->platform->clContext;
+    StagingSegment& segment = uploader->inFlight.front();
+
+    CL_CHECK(clWaitForEvents(1, &segment.event));
+    CL_CHECK(clReleaseEvent(segment.event));
+    uploader->inFlight.pop_front();
+}
+
+// Release segments whose transfers already finished, without blocking
+void _retireCompleted(UploadManager uploader)
+{
+    CLContext* ctx = uploader->platform->clContext;
+
+    while (!uploader->inFlight.empty())
+    {
+        cl_int status;
+        CL_CHECK(clGetEventInfo(uploader->inFlight.front().event,
+            CL_EVENT_COMMAND_EXECUTION_STATUS, sizeof(cl_int), &status, NULL));
+        if (status != CL_COMPLETE)
+            break;
+        _retireOldest(uploader);
+    }
+}
+
+// Returns ring offset of a free range of `size` bytes, waiting on old transfers if needed.
+size_t _acquire(UploadManager uploader, size_t size)
+{
+    size = (size + STAGING_ALIGNMENT - 1) / STAGING_ALIGNMENT * STAGING_ALIGNMENT;
+    if (uploader->staging == NULL)
+        _createStaging(uploader);
+    _retireCompleted(uploader);
+
+    while (true)
+    {
+        if (uploader->inFlight.empty())
+        {
+            uploader->head = 0;
+            break;
+        }
+
+        size_t tail = uploader->inFlight.front().begin;
+        if (uploader->head > tail)
+        {
+            // free: [head, end) and [0, tail)
+            if (uploader->head + size <= uploader->size)
+                break;
+            if (size < tail)
+            {
+                uploader->head = 0;
+                break;
+            }
+        }
+        else if (uploader->head < tail)
+        {
+            // free: [head, tail)
+            if (uploader->head + size < tail)
+                break;
+        }
+        // head == tail: ring is full
+
+        _retireOldest(uploader);
+    }
+
+    size_t offset = uploader->head;
+    uploader->head += size;
+    return offset;
+}
+
+size_t _chunkSize(UploadManager uploader)
+{
+    // Keep several chunks in flight so copies into the ring overlap transfers.
+    return uploader->size / 4;
+}
+
+void UploadBuffer(UploadManager uploader, Buffer handle,
+    size_t size, const void* data, size_t offset)
+{
+    CLContext* ctx = uploader->platform->clContext;
+    const unsigned char* src = (const unsigned char*) data;
+
+    if (uploader->directMap)
+    {
+        void* dst = CL_CHECK2(clEnqueueMapBuffer(ctx->commandQueue, handle, CL_TRUE,
+            CL_MAP_WRITE_INVALIDATE_REGION, offset, size, 0, NULL, NULL, &_err));
+        memcpy(dst, src, size);
+
+        cl_event unmapped;
+        CL_CHECK(clEnqueueUnmapMemObject(ctx->commandQueue, handle, dst, 0, NULL, &unmapped));
+        uploader->unmaps.push_back(unmapped);
+        return;
+    }
+
+    size_t uploaded = 0;
+    while (uploaded < size)
+    {
+        size_t chunk = std::min(size - uploaded, _chunkSize(uploader));
+        size_t ringOffset = _acquire(uploader, chunk);
+        memcpy(uploader->mapped + ringOffset, src + uploaded, chunk);
+
+        StagingSegment segment = {ringOffset, uploader->head, NULL};
+        CL_CHECK(clEnqueueWriteBuffer(ctx->commandQueue, handle, CL_FALSE,
+            offset + uploaded, chunk, uploader->mapped + ringOffset,
+            0, NULL, &segment.event));
+        uploader->inFlight.push_back(segment);
+
+        uploaded += chunk;
+    }
+}
+
+void UploadImage(UploadManager uploader, ImageArray handle,
+    unsigned int width, unsigned int height, size_t arrayIndex, const void* data)
+{
+    CLContext* ctx = uploader->platform->clContext;
+    const unsigned char* src = (const unsigned char*) data;
+
+    size_t rowPitch = width * RD_CHANNEL;
+    size_t rowsPerChunk = _chunkSize(uploader) / rowPitch;
+    if (rowsPerChunk == 0)
+    {
+        printf("Staging ring too small for image rows of %lu bytes\n", rowPitch);
+        throw;
+    }
+
+    size_t row = 0;
+    while (row < height)
+    {
+        size_t rows = std::min(height - row, rowsPerChunk);
+        size_t chunk = rows * rowPitch;
+        size_t ringOffset = _acquire(uploader, chunk);
+        memcpy(uploader->mapped + ringOffset, src + row * rowPitch, chunk);
+
+        size_t origin[3] = {0, row, arrayIndex};
+        size_t region[3] = {width, rows, 1};
+
+        StagingSegment segment = {ringOffset, uploader->head, NULL};
+        CL_CHECK(clEnqueueWriteImage(ctx->commandQueue, handle, CL_FALSE,
+            origin, region, rowPitch, 0, uploader->mapped + ringOffset,
+            0, NULL, &segment.event));
+        uploader->inFlight.push_back(segment);
+
+        row += rows;
+    }
+}
+
+void FlushUploads(UploadManager uploader)
+{
+    CLContext* ctx = uploader->platform->clContext;
+    CL_CHECK(clFlush(ctx->commandQueue));
+
+    while (!uploader->inFlight.empty())
+        _retireOldest(uploader);
+    uploader->head = 0;
+
+    if (!uploader->unmaps.empty())
+    {
+        CL_CHECK(clWaitForEvents(uploader->unmaps.size(), uploader->unmaps.data()));
+        for (cl_event unmapped: uploader->unmaps)
+            CL_CHECK(clReleaseEvent(unmapped));
+        uploader->unmaps.clear();
+    }
+}
+
+void DestroyUploadManager(UploadManager uploader)
+{
+    CLContext* ctx = uploader->platform->clContext;
+    FlushUploads(uploader);
+
+    if (uploader->staging)
+    {
+        CL_CHECK(clEnqueueUnmapMemObject(ctx->commandQueue,
+            uploader->staging, uploader->mapped, 0, NULL, NULL));
+        CL_CHECK(clFinish(ctx->commandQueue));
+        CL_CHECK(clReleaseMemObject(uploader->staging));
+    }
+    delete uploader;
+}
+
+} // namespace RD
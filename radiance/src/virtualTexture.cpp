@@ -0,0 +1,207 @@
+#include "texture.h"
+
+#include <algorithm>
+#include <list>
+#include <cstring>
+
+namespace RD
+{
+
+struct _VirtualTexture
+{
+    Platform* platform;
+    const unsigned char* source; // whole texel buffer, pages are copied out of it
+    size_t size;
+
+    unsigned int pageCount;
+    unsigned int slotCount;
+
+    Buffer pool;      // slotCount pages
+    Buffer pageTable; // slot per page
+    Buffer feedback;  // TEXTURE_FEEDBACK_* per page
+
+    // Host copies
+    std::vector<uint32_t> pageSlots;
+    std::vector<uint32_t> feedbackData;
+
+    std::vector<uint32_t> freeSlots;
+    std::vector<bool> pinned;
+    std::vector<uint8_t> pageDepth; // levels above the last one, 0 for the coarsest pages
+    std::list<uint32_t> lru; // resident pages that can be evicted, most recently used first
+    std::vector<std::list<uint32_t>::iterator> lruEntry;
+    std::vector<uint32_t> lastUse; // update index a page was last sampled in
+    uint32_t updateIndex;
+};
+
+void _loadPage(VirtualTexture texture, uint32_t page, uint32_t slot)
+{
+    size_t offset = (size_t)page * TEXTURE_PAGE_SIZE;
+    size_t size = std::min((size_t)TEXTURE_PAGE_SIZE, texture->size - offset);
+    WriteBuffer(texture->platform, texture->pool, size,
+        (void*)(texture->source + offset), (size_t)slot * TEXTURE_PAGE_SIZE);
+    texture->pageSlots[page] = slot;
+}
+
+VirtualTexture CreateVirtualTexture(Platform* platform, const std::vector<TextureInfo>& infos,
+    const void* texels, size_t size, size_t poolSize)
+{
+    _VirtualTexture* texture = new _VirtualTexture();
+    texture->platform = platform;
+    texture->source = (const unsigned char*)texels;
+    texture->size = size;
+    texture->pageCount = (size + TEXTURE_PAGE_SIZE - 1) / TEXTURE_PAGE_SIZE;
+    texture->slotCount = std::min<size_t>(poolSize / TEXTURE_PAGE_SIZE, texture->pageCount);
+    texture->pageSlots.assign(texture->pageCount, TEXTURE_PAGE_NONE);
+    texture->feedbackData.assign(texture->pageCount, 0);
+    texture->pinned.assign(texture->pageCount, false);
+    texture->pageDepth.assign(texture->pageCount, TEXTURE_MAX_LEVELS);
+    texture->lruEntry.resize(texture->pageCount);
+    texture->lastUse.assign(texture->pageCount, 0);
+    texture->updateIndex = 0;
+
+    // Pages shared by several levels take the coarsest of them
+    for (const TextureInfo& info: infos)
+    {
+        for (unsigned int level = 0; level < info.levelCount; level++)
+        {
+            size_t begin = info.levelOffset[level];
+            size_t end = begin + TextureLevelBytes(info, level);
+            uint8_t depth = info.levelCount - 1 - level;
+            for (size_t page = begin / TEXTURE_PAGE_SIZE; page <= (end - 1) / TEXTURE_PAGE_SIZE; page++)
+                texture->pageDepth[page] = std::min(texture->pageDepth[page], depth);
+        }
+    }
+
+    // The last level is the fallback of every miss, it never leaves the pool
+    unsigned int pinnedCount = 0;
+    for (const TextureInfo& info: infos)
+    {
+        unsigned int last = info.levelCount - 1;
+        size_t begin = info.levelOffset[last];
+        size_t end = begin + TextureLevelBytes(info, last);
+        for (size_t page = begin / TEXTURE_PAGE_SIZE; page <= (end - 1) / TEXTURE_PAGE_SIZE; page++)
+        {
+            pinnedCount += !texture->pinned[page];
+            texture->pinned[page] = true;
+        }
+    }
+
+    if (pinnedCount >= texture->slotCount && texture->slotCount < texture->pageCount)
+    {
+        printf("Virtual texture pool of %lu bytes cannot hold the %u pinned pages\n",
+            poolSize, pinnedCount);
+        throw;
+    }
+
+    texture->pool = CreateBuffer(platform, texture->slotCount * TEXTURE_PAGE_SIZE);
+    texture->pageTable = CreateBuffer(platform, texture->pageCount * sizeof(uint32_t));
+    texture->feedback = CreateBuffer(platform, texture->pageCount * sizeof(uint32_t));
+
+    uint32_t slot = 0;
+    for (uint32_t page = 0; page < texture->pageCount; page++)
+        if (texture->pinned[page])
+            _loadPage(texture, page, slot++);
+    for (uint32_t free = texture->slotCount; free > slot; free--)
+        texture->freeSlots.push_back(free - 1);
+
+    WriteBuffer(platform, texture->pageTable, texture->pageCount * sizeof(uint32_t),
+        texture->pageSlots.data());
+    WriteBuffer(platform, texture->feedback, texture->pageCount * sizeof(uint32_t),
+        texture->feedbackData.data());
+
+    printf("Virtual texture: %u pages, %u resident slots, %u pinned\n",
+        texture->pageCount, texture->slotCount, pinnedCount);
+    return texture;
+}
+
+void DestroyVirtualTexture(VirtualTexture texture)
+{
+    CLContext* ctx = texture->platform->clContext;
+    CL_CHECK(clReleaseMemObject(texture->pool));
+    CL_CHECK(clReleaseMemObject(texture->pageTable));
+    CL_CHECK(clReleaseMemObject(texture->feedback));
+    delete texture;
+}
+
+unsigned int UpdateVirtualTexture(VirtualTexture texture, unsigned int maxPages)
+{
+    Platform* platform = texture->platform;
+    size_t tableSize = texture->pageCount * sizeof(uint32_t);
+    ReadBuffer(platform, texture->feedback, tableSize, texture->feedbackData.data());
+    texture->updateIndex++;
+
+    std::vector<uint32_t> missing;
+    for (uint32_t page = 0; page < texture->pageCount; page++)
+    {
+        uint32_t mark = texture->feedbackData[page];
+        if (mark == 0)
+            continue;
+
+        texture->lastUse[page] = texture->updateIndex;
+        if (texture->pageSlots[page] == TEXTURE_PAGE_NONE)
+            missing.push_back(page);
+        else if (!texture->pinned[page])
+            texture->lru.splice(texture->lru.begin(), texture->lru, texture->lruEntry[page]);
+    }
+
+    // Cleared before the next batch, only the latest batch counts
+    std::fill(texture->feedbackData.begin(), texture->feedbackData.end(), 0);
+    WriteBuffer(platform, texture->feedback, tableSize, texture->feedbackData.data());
+
+    // Coarse levels first, a miss falls back to the next coarser level so those
+    // stop the blur sooner and are small enough for many to load per update
+    std::stable_sort(missing.begin(), missing.end(), [texture](uint32_t a, uint32_t b) {
+        return texture->pageDepth[a] < texture->pageDepth[b];
+    });
+
+    unsigned int loaded = 0;
+    for (uint32_t page: missing)
+    {
+        if (loaded == maxPages)
+            break;
+
+        uint32_t slot;
+        if (!texture->freeSlots.empty())
+        {
+            slot = texture->freeSlots.back();
+            texture->freeSlots.pop_back();
+        }
+        else
+        {
+            // Pages sampled by the last batch are still in use, evicting them would thrash
+            if (texture->lru.empty() ||
+                texture->lastUse[texture->lru.back()] == texture->updateIndex)
+                break;
+            uint32_t victim = texture->lru.back();
+            texture->lru.pop_back();
+            slot = texture->pageSlots[victim];
+            texture->pageSlots[victim] = TEXTURE_PAGE_NONE;
+        }
+
+        _loadPage(texture, page, slot);
+        texture->lru.push_front(page);
+        texture->lruEntry[page] = texture->lru.begin();
+        loaded++;
+    }
+
+    if (loaded > 0)
+        WriteBuffer(platform, texture->pageTable, tableSize, texture->pageSlots.data());
+    return loaded;
+}
+
+Buffer VirtualTexturePool(VirtualTexture texture)
+{
+    return texture->pool;
+}
+
+Buffer VirtualTexturePageTable(VirtualTexture texture)
+{
+    return texture->pageTable;
+}
+
+Buffer VirtualTextureFeedback(VirtualTexture texture)
+{
+    return texture->feedback;
+}
+
+} // namespace RD
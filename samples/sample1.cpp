@@ -1,9 +1,14 @@
 #include <cassert>
+#include <chrono>
+#include <future>
 
 #include "radiance.h"
 #include "sceneBuilder.h"
 #include "inspector.h"
 
+// samples/*.cl, embedded at build time (see samples/CMakeLists.txt)
+extern const RD::EmbeddedShader sampleShaders[];
+
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stb_image_write.h"
 
@@ -15,6 +20,9 @@
 #else
 #define LOAD_CACHE false
 #endif
+
+// Cooked scenes with more texture data than this page it in on demand
+#define TEXTURE_BUDGET (256u << 20)
 struct CbData
 {
     RD::Platform* plt;
@@ -22,10 +30,19 @@ struct CbData
     uint8_t* image;
     RD::Buffer rdImage;
     size_t imageSize;
+    bool zeroCopy; // image is mapped from rdImage instead of read back
 
     RD::Buffer rdCamData;
     RD::Buffer rdSceneData;
-    RD::Buffer rdRTProp;
+
+    // Host copies, edited by the UI without reading the buffers back
+    RD::PhysicalCamera camData;
+    RD::SceneProperties sceneData;
+    RD::RayTraceProperties RTProp; // push constant
+
+    RD::CommandBuffer cmdBuffer;
+
+    RD::Scene* scene;
 };
 
 void render(void* data, unsigned char** image, int* out_width, int* out_height);
@@ -66,6 +83,20 @@ inline void blenderToCameraTranslate(float x, float y, float z, float& xOut, flo
     zOut = -y;
 }
 
+void setConstant(std::vector<RD::SpecializationConstant>& constants, const char* name, int value)
+{
+    for (RD::SpecializationConstant& constant : constants)
+    {
+        if (constant.name == name)
+        {
+            constant.value = value;
+            return;
+        }
+    }
+    printf("Unknown specialization constant %s\n", name);
+    throw;
+}
+
 RD::DirLight blenderToDirLight(float xDeg, float zDeg, float intensity)
 {
     float xRad = blenderToXRad(-xDeg);
@@ -103,7 +134,8 @@ int main()
         // "/home/zekailin00/Desktop/ray-tracing/framework/assets/benchmark/cornell-bike-and-car.glb";
         // "/home/zekailin00/Desktop/ray-tracing/framework/assets/benchmark/cornell-house.glb";
 
-    std::string shaderPath = "/home/zekailin00/Desktop/ray-tracing/framework/samples/shader.cl";
+    // Name in the embedded sample shaders, or a path to load from disk
+    std::string shaderPath = "shader.cl";
 
     RD::SceneProperties sceneData;
     sceneData.lightCount[0] = 1;
@@ -363,16 +395,90 @@ int main()
 void rayTracer(const std::string& modelFile, std::string& shaderPath,
     RD::RayTraceProperties& RTProp, RD::PhysicalCamera& camData, RD::SceneProperties& sceneData)
 {
+    auto startTime = std::chrono::high_resolution_clock::now();
+    auto elapsedMs = [&startTime]() {
+        return std::chrono::duration<double, std::milli>(
+            std::chrono::high_resolution_clock::now() - startTime).count();
+    };
+
     size_t imageSize = camData.widthPixel * camData.heightPixel * RD_CHANNEL;
-    uint8_t* image = (uint8_t*)malloc(imageSize);
 
     /* Intialize platform */
     RD::Platform* plt = RD::Platform::GetPlatform();
+    double platformReady = elapsedMs();
 
-    RD::Buffer rdRTProp = RD::CreateBuffer(plt, sizeof(RD::RayTraceProperties));
-    RD::WriteBuffer(plt, rdRTProp, sizeof(RD::RayTraceProperties), &RTProp);
+    /* Build shader module */
+    char* shaderCode = (char*)RD::FindEmbeddedShader(sampleShaders, shaderPath.c_str());
+    size_t shaderSize;
+    if (shaderCode)
+        shaderSize = strlen(shaderCode);
+    else
+        RD::read_kernel_file_str(shaderPath.c_str(), &shaderCode, &shaderSize);
+    std::vector<RD::ShaderModule> shaders = {
+        RD::CreateShaderModule(plt, shaderCode, shaderSize, "raygen",      RD::RAYGEN_STAGE),
+        RD::CreateShaderModule(plt, shaderCode, shaderSize, "material",    RD::CLOSEST_HIT_STAGE),
+        RD::CreateShaderModule(plt, shaderCode, shaderSize, "shadow",      RD::CLOSEST_HIT_STAGE),
+        RD::CreateShaderModule(plt, shaderCode, shaderSize, "anyShadow",   RD::ANY_HIT_STAGE),
+        RD::CreateShaderModule(plt, shaderCode, shaderSize, "environment", RD::MISS_STAGE),
+        RD::CreateShaderModule(plt, shaderCode, shaderSize, "shadowMiss",  RD::MISS_STAGE)
+    };
+
+    // Group index is the SBT index used by traceRay() in shader.cl
+    std::vector<RD::ShaderGroup> groups = {
+        {0,                 SHADER_UNUSED, SHADER_UNUSED}, // 0: raygen
+        {SHADER_UNUSED,     1,             SHADER_UNUSED}, // 1: material hit
+        {SHADER_UNUSED,     2,             3            }, // 2: shadow hit
+        {4,                 SHADER_UNUSED, SHADER_UNUSED}, // 3: environment miss
+        {5,                 SHADER_UNUSED, SHADER_UNUSED}  // 4: shadow miss
+    };
+
+    RD::PipelineLayout layout = RD::CreatePipelineLayout({
+        RD::BUFFER_TYPE, RD::IMAGE_TYPE,
+        RD::BUFFER_TYPE, RD::BUFFER_TYPE,
+        INCLUDE_SCENE_LAYOUT},
+        {sizeof(RD::RayTraceProperties)});
+
+    // Fold per-scene values into the kernel, the debug mode stays a push constant
+    // so the UI can switch it without a rebuild. Fast relaxed math is left off,
+    // the BVH slab test depends on inf for axis aligned rays.
+    // Material features are unknown until the scene is loaded, start with all of them.
+    std::vector<RD::SpecializationConstant> constants = {
+        {"SPEC_MAX_DEPTH",    (int)RTProp.depth},
+        {"SPEC_LIGHT_COUNT",  (int)sceneData.lightCount[0]},
+        {"SPEC_TEXTURES",     1},
+        {"SPEC_TRANSMISSION", 1},
+        {"TEXTURE_VIRTUAL",   0}
+    };
 
-    RD::Buffer rdImage   = RD::CreateImage(plt, camData.widthPixel, camData.heightPixel);
+    /* Compile in the background */
+    RD::Pipeline pipeline = RD::CreatePipelineAsync(plt, {
+        1,          // maxRayRecursionDepth
+        layout,     // PipelineLayout
+        shaders,    // ShaderModule
+        groups,     // ShaderGroup
+        constants,  // SpecializationConstant
+        RD_COMPILE_MAD_ENABLE
+    });
+
+    /* Import scene and build BVH on another thread */
+    double sceneReady;
+    std::future<RD::Scene*> sceneLoad = std::async(std::launch::async,
+        [&modelFile, plt, &sceneReady, &elapsedMs]() {
+            // A cooked scene skips the import entirely, see tools/sceneCooker.cpp
+            RD::Scene* scene = RD::Scene::LoadCooked(modelFile + COOKED_SCENE_EXTENSION,
+                modelFile, plt, TEXTURE_BUDGET);
+            if (scene == nullptr)
+                scene = RD::Scene::Load(modelFile, plt, LOAD_CACHE);
+            sceneReady = elapsedMs();
+            return scene;
+        });
+
+    // Devices sharing memory with the host map the output image in place
+    bool zeroCopy = RD::HasUnifiedMemory(plt);
+    uint8_t* image = zeroCopy ? nullptr : (uint8_t*)malloc(imageSize);
+
+    RD::Buffer rdImage   = RD::CreateImage(plt, camData.widthPixel, camData.heightPixel,
+        zeroCopy ? RD_MEMORY_HOST_ALLOC : RD_MEMORY_DEVICE);
     RD::Buffer rdImageScratch = RD::CreateBuffer(plt, imageSize * sizeof(float));
 
     RD::Buffer rdCamData = RD::CreateBuffer(plt, sizeof(camData));
@@ -380,31 +486,49 @@ void rayTracer(const std::string& modelFile, std::string& shaderPath,
 
     RD::Buffer rdSceneData = RD::CreateBuffer(plt, sizeof(RD::SceneProperties));
     RD::WriteBuffer(plt, rdSceneData, sizeof(sceneData), &sceneData);
+    double buffersReady = elapsedMs();
+
+    /* Join: scene first, its buffers are needed for the descriptor set */
+    RD::Scene* scene = sceneLoad.get();
+    if (scene == nullptr)
+    {
+        printf("Failed to load scene %s\n", modelFile.c_str());
+        exit(1);
+    }
+
+    // Drop unused material paths. The variant compiles next to the all-features
+    // one from here on, later runs load it from the program cache.
+    bool specialize = !scene->hasTextures || !scene->hasTransmission || scene->virtualTexture;
+    if (specialize)
+    {
+        setConstant(constants, "SPEC_TEXTURES", scene->hasTextures);
+        setConstant(constants, "SPEC_TRANSMISSION", scene->hasTransmission);
+        setConstant(constants, "TEXTURE_VIRTUAL", scene->virtualTexture != nullptr);
+        RD::SpecializePipelineAsync(pipeline, constants);
+    }
+
+    double waitBegin = elapsedMs();
+    RD::WaitForPipeline(pipeline);
+    double pipelineReady = elapsedMs();
 
-    RD::Scene* scene = RD::Scene::Load(modelFile, plt, LOAD_CACHE);
+    if (specialize)
+        RD::SpecializePipeline(pipeline, constants);
+    double specializeReady = elapsedMs();
 
-    /* Build and configure pipeline */
     RD::DescriptorSet descSet = RD::CreateDescriptorSet({
-        rdRTProp, rdImageScratch, rdImage,
+        rdImageScratch, rdImage,
         rdCamData, rdSceneData,
         INCLUDE_SCENE_DESC(scene)});
-    RD::PipelineLayout layout = RD::CreatePipelineLayout({
-        RD::BUFFER_TYPE, RD::BUFFER_TYPE, RD::IMAGE_TYPE,
-        RD::BUFFER_TYPE, RD::BUFFER_TYPE,
-        INCLUDE_SCENE_LAYOUT});
 
-    /* Build shader module */
-    char* shaderCode;
-    size_t shaderSize;
-    RD::read_kernel_file_str(shaderPath.c_str(), &shaderCode, &shaderSize);
-    RD::ShaderModule shader = RD::CreateShaderModule(plt, shaderCode, shaderSize, "functName..");
-
-    RD::Pipeline pipeline = RD::CreatePipeline({
-        1,          // maxRayRecursionDepth
-        layout,     // PipelineLayout
-        {shader},   // ShaderModule
-        {}          // ShaderGroup
-    });
+    printf("\nStartup timing (ms since start):\n");
+    printf("\tPlatform ready:          %.1f\n", platformReady);
+    printf("\tBuffers ready:           %.1f\n", buffersReady);
+    printf("\tScene ready:             %.1f\n", sceneReady);
+    printf("\tPipeline ready:          %.1f (waited %.1f after scene)\n",
+        pipelineReady, pipelineReady - waitBegin);
+    printf("\tSpecialized:             %.1f\n", specializeReady);
+    printf("\tCritical path:           %s\n",
+        pipelineReady - waitBegin > 1.0 ? "pipeline build" : "scene import");
 
     /* Ray tracing */
     RD::BindPipeline(plt, pipeline);    
@@ -420,10 +544,18 @@ void rayTracer(const std::string& modelFile, std::string& shaderPath,
         .image = image,
         .rdImage = rdImage,
         .imageSize = imageSize,
+        .zeroCopy = zeroCopy,
 
         .rdCamData = rdCamData,
         .rdSceneData = rdSceneData,
-        .rdRTProp = rdRTProp
+
+        .camData = camData,
+        .sceneData = sceneData,
+        .RTProp = RTProp,
+
+        .cmdBuffer = RD::CreateCommandBuffer(plt),
+
+        .scene = scene
     };
 
 #ifdef OFF_SCREEN
@@ -440,6 +572,16 @@ void rayTracer(const std::string& modelFile, std::string& shaderPath,
 #else
     renderLoop(render, &data);
 #endif
+
+    if (data.zeroCopy && data.image)
+        RD::UnmapBuffer(plt, rdImage, data.image);
+    else
+        free(data.image);
+    RD::DestroyCommandBuffer(data.cmdBuffer);
+    RD::DestroyPipeline(pipeline);
+    for (RD::ShaderModule shader: shaders)
+        RD::DestroyShaderModule(shader);
+    delete scene;
 }
 
 #include "imgui.h"
@@ -463,10 +605,34 @@ void render(void* data, unsigned char** image, int* out_width, int* out_height)
     printf("\nStart of ray tracing: %s", timeStr);
 #endif
 
-    RD::TraceRays(d->plt, 0,0,0, d->extent[0], d->extent[1]);
+    /* Previous frame stays mapped until the kernel writes the image again */
+    if (d->zeroCopy && d->image)
+    {
+        RD::UnmapBuffer(d->plt, d->rdImage, d->image);
+        d->image = nullptr;
+    }
+
+    /* Page in the textures the previous batch missed, its samples used coarser levels */
+    if (d->scene->StreamTextures() > 0)
+        updated = true;
+
+    /* Restart accumulation when the scene changed */
+    if (updated)
+        d->RTProp.totalSamples = 0;
 
-    /* Fetch result */
-    RD::ReadBuffer(d->plt, d->rdImage, d->imageSize, d->image);
+    /* Trace and fetch result in one submission */
+    RD::ResetCommandBuffer(d->cmdBuffer);
+    RD::CmdPushConstants(d->cmdBuffer, 0, sizeof(RD::RayTraceProperties), &d->RTProp);
+    RD::CmdTraceRays(d->cmdBuffer, 0,0,0, d->extent[0], d->extent[1]);
+    if (!d->zeroCopy)
+        RD::CmdReadBuffer(d->cmdBuffer, d->rdImage, d->imageSize, d->image);
+    RD::Fence fence = RD::SubmitCommandBuffer(d->plt, d->cmdBuffer);
+
+    RD::WaitForFence(d->plt, fence);
+    RD::DestroyFence(fence);
+
+    if (d->zeroCopy)
+        d->image = (uint8_t*) RD::MapBuffer(d->plt, d->rdImage, d->imageSize, RD_MAP_READ);
 
 #ifdef OFF_SCREEN
     time(&end_t);
@@ -477,18 +643,7 @@ void render(void* data, unsigned char** image, int* out_width, int* out_height)
 #endif
 
     /* Update frame sample counts */
-    RD::RayTraceProperties RTProp;
-    RD::ReadBuffer(d->plt, d->rdRTProp, sizeof(RD::RayTraceProperties), &RTProp);
-    if (updated)
-    {
-        RTProp.totalSamples = 0;
-    }
-    else
-    {
-        RTProp.totalSamples += RTProp.batchSize;
-    }
-    RD::WriteBuffer(d->plt, d->rdRTProp, sizeof(RD::RayTraceProperties), &RTProp);
-
+    d->RTProp.totalSamples += d->RTProp.batchSize;
 
 #ifndef OFF_SCREEN
     *image = d->image;
@@ -501,14 +656,9 @@ void render(void* data, unsigned char** image, int* out_width, int* out_height)
 bool RenderSceneConfigUI(CbData *d)
 {
     bool updated = false;
-    RD::PhysicalCamera camData;
-    RD::ReadBuffer(d->plt, d->rdCamData, sizeof(camData), &camData);
-
-    RD::SceneProperties scene;
-    RD::ReadBuffer(d->plt, d->rdSceneData, sizeof(scene), &scene);
-
-    RD::RayTraceProperties RTProp;
-    RD::ReadBuffer(d->plt, d->rdRTProp, sizeof(RD::RayTraceProperties), &RTProp);
+    RD::PhysicalCamera& camData = d->camData;
+    RD::SceneProperties& scene = d->sceneData;
+    RD::RayTraceProperties& RTProp = d->RTProp;
 
     {
         ImGui::Begin("Render Config");
@@ -541,7 +691,6 @@ bool RenderSceneConfigUI(CbData *d)
     {
         RD::WriteBuffer(d->plt, d->rdCamData, sizeof(camData), &camData);
         RD::WriteBuffer(d->plt, d->rdSceneData, sizeof(scene), &scene);
-        RD::WriteBuffer(d->plt, d->rdRTProp, sizeof(RD::RayTraceProperties), &RTProp);
     }
 
     return updated;
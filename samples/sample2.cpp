@@ -10,6 +10,9 @@
 
 #include "inspector.h"
 
+// samples/*.cl, embedded at build time (see samples/CMakeLists.txt)
+extern const RD::EmbeddedShader sampleShaders[];
+
 #define OFF_SCREEN
 
 bool modelLoader(
@@ -93,8 +96,6 @@ int main()
 {
     std::string modelFile =
         "/home/zekailin00/Desktop/ray-tracing/framework/assets/monkey-smooth.obj";
-    std::string shaderPath =
-        "/home/zekailin00/Desktop/ray-tracing/framework/samples/shader2.cl";
     std::string tex0Path =
         "/home/zekailin00/Desktop/ray-tracing/framework/assets/test0.png";
     std::string tex1Path =
@@ -107,11 +108,9 @@ int main()
     /* Intialize platform */
     RD::Platform* plt = RD::Platform::GetPlatform();
 
-    /* Build shader module */
-    char* shaderCode;
-    size_t shaderSize;
-    RD::read_kernel_file_str(shaderPath.c_str(), &shaderCode, &shaderSize);
-    RD::ShaderModule shader = RD::CreateShaderModule(plt, shaderCode, shaderSize, "functName..");
+    /* Build shader module, embedded at build time */
+    const char* shaderCode = RD::FindEmbeddedShader(sampleShaders, "shader2.cl");
+    RD::ShaderModule shader = RD::CreateShaderModule(plt, shaderCode, strlen(shaderCode), "functName..");
 
     /* Load mesh and build accel struct */
     RD::Mesh mesh;
@@ -149,39 +148,28 @@ int main()
 
     RD::Buffer rdImage = RD::CreateImage(plt, extent[0], extent[1]);
 
-    RD::ImageArray rdImageArray = RD::CreateImageArray(plt, 1024, 1024, 2);
-
-    RD::Sampler rdSampler =  RD::CreateSampler(plt,
-        RD_ADDRESS_REPEAT, RD_FILTER_LINEAR);
-
+    /* Texture table, the shader samples texture 0 */
+    std::vector<RD::TextureInfo> textureInfos;
+    std::vector<unsigned char> textureData;
+    for (const std::string& texPath: {tex0Path, tex1Path})
     {
         int texWidth, texHeight, texChannel;
-        unsigned char *data = stbi_load(tex0Path.c_str(),
+        unsigned char *data = stbi_load(texPath.c_str(),
             &texWidth, &texHeight, &texChannel, 4);
+        assert(data);
 
-        assert(texWidth == 1024);
-        assert(texHeight == 1024);
-        RD::WriteImage(plt, rdImageArray, texWidth, texHeight, 0, data);
+        std::vector<unsigned char> levels;
+        RD::BuildMipChain(texWidth, texHeight, data, levels);
+        RD::AppendTexture(textureInfos, textureData, texWidth, texHeight, levels);
         stbi_image_free(data);
     }
-    {
-        int texWidth, texHeight, texChannel=4;
-        unsigned char *data = stbi_load(tex1Path.c_str(),
-            &texWidth, &texHeight, &texChannel, 4);
 
-        assert(texWidth == 1024);
-        assert(texHeight == 1024);
-        RD::WriteImage(plt, rdImageArray, texWidth, texHeight, 1, data);
-        stbi_image_free(data);
-    }
+    unsigned int textureInfoSize = textureInfos.size() * sizeof(RD::TextureInfo);
+    RD::Buffer rdTextureInfoData = RD::CreateBuffer(plt, textureInfoSize);
+    RD::WriteBuffer(plt, rdTextureInfoData, textureInfoSize, textureInfos.data());
 
-    {
-        unsigned char data[1024 * 1024 * 4];
-        RD::ReadImage(plt, rdImageArray, 1024, 1024, 0, data);
-        stbi_write_jpg("blue.jpg", 1024, 1024, RD_CHANNEL, data, 100);
-        RD::ReadImage(plt, rdImageArray, 1024, 1024, 1, data);
-        stbi_write_jpg("pink.jpg", 1024, 1024, RD_CHANNEL, data, 100);
-    }
+    RD::Buffer rdTextureData = RD::CreateBuffer(plt, textureData.size());
+    RD::WriteBuffer(plt, rdTextureData, textureData.size(), textureData.data());
 
     RD::Buffer rdExtent  = RD::CreateBuffer(plt, sizeof(extent));
     RD::WriteBuffer(plt, rdExtent, sizeof(extent), extent);
@@ -225,15 +213,15 @@ int main()
         rdRTProp,     rdImageScratch, rdImage,      rdExtent,   rdCamData,
         rdVertexData, rdNormalData,   rdUVData,
         rdIndexData,  rdMatData,      rdSceneData,
-        rdImageArray, rdSampler,
+        rdTextureInfoData, rdTextureData,
         rdTopAS});
     RD::PipelineLayout layout = RD::CreatePipelineLayout({
         RD::BUFFER_TYPE, RD::BUFFER_TYPE, RD::IMAGE_TYPE,  RD::BUFFER_TYPE, RD::BUFFER_TYPE,
         RD::BUFFER_TYPE, RD::BUFFER_TYPE, RD::BUFFER_TYPE,
         RD::BUFFER_TYPE, RD::BUFFER_TYPE, RD::BUFFER_TYPE,
-        RD::IMAGE_ARRAY_TYPE, RD::IMAGE_SAMPLER,
+        RD::BUFFER_TYPE, RD::BUFFER_TYPE,
         RD::ACCEL_STRUCT_TYPE});
-    RD::Pipeline pipeline     = RD::CreatePipeline({
+    RD::Pipeline pipeline     = RD::CreatePipeline(plt, {
         1,          // maxRayRecursionDepth
         layout,     // PipelineLayout
         {shader},   // ShaderModule
@@ -1,5 +1,16 @@
 #include "radiance.cl"
 #include "pbr.cl"
+#include "surface.cl"
+
+// Specialization constants, defined by the pipeline with -D.
+// SPEC_MAX_DEPTH, SPEC_DEBUG and SPEC_LIGHT_COUNT fall back to
+// the values in global memory when not specialized.
+#ifndef SPEC_TEXTURES
+#define SPEC_TEXTURES 1     // any material samples a texture
+#endif
+#ifndef SPEC_TRANSMISSION
+#define SPEC_TRANSMISSION 1 // any material has transmission
+#endif
 
 struct Payload
 {
@@ -9,6 +20,10 @@ struct Payload
     float3 nextFactor;
     float3 nextRayOrigin;
     float3 nextRayDirection;
+
+    // Ray cone for texture LOD, width at the ray origin and spread angle
+    float coneWidth;
+    float coneSpread;
 };
 
 struct SceneData
@@ -16,12 +31,8 @@ struct SceneData
     __global struct PhysicalCamera*     camData;
     __global struct SceneProperties*    scene;
     
-    __global struct MeshInfo*           meshInfoData;
-    __global float*                     vertexData;
-    __global uint*                      indexData;
-    __global float*                     uvData;
-    __global float*                     normalData;
-    __global struct Material*           materials;
+    struct SurfaceTable                 surfaces;
+    struct TextureTable                 textures;
     __global struct AccelStruct*        topLevel;
 
     int                        depth;
@@ -108,15 +119,17 @@ inline float2 sampleUniformDisk(float2 u)
     return r * tmp;
 }
 
-void generateRay(const global struct PhysicalCamera* cam,
-    const uint3 randomInput, float3* position, float3* direction)
+// Spread angle of a primary ray cone, one pixel on the sensor
+inline float getPixelSpread(const global struct PhysicalCamera* cam)
 {
-    /* the unique global id of the work item for the current pixel */
-    const int index = get_global_id(0);
+    return atan(cam->sensorWidth / (cam->widthPixel * cam->focalLength));
+}
 
-    // Index for accessing image data
-    const int x = index % (int)cam->widthPixel; /* x-coordinate of the pixel */
-    const int y = index / (int)cam->widthPixel; /* y-coordinate of the pixel */
+void generateRay(const global struct PhysicalCamera* cam, const int2 pixel,
+    const uint3 randomInput, float3* position, float3* direction)
+{
+    const int x = pixel.x; /* x-coordinate of the pixel */
+    const int y = pixel.y; /* y-coordinate of the pixel */
 
     float3 random = random_pcg3d(randomInput);
 
@@ -173,7 +186,6 @@ void generateRay(const global struct PhysicalCamera* cam,
 }
 
 __kernel void raygen(
-    __global struct RayTraceProperties* RTProp,
     __global float*                     imageScratch,
     __global uchar*                     image /* <row major> */,
     __global struct PhysicalCamera*     camData,
@@ -181,29 +193,50 @@ __kernel void raygen(
 
     __global struct MeshInfo*           meshInfoData,
     __global float*                     vertexData,
-    __global uint*                      indexData,
-    __global float*                     uvData,
-    __global float*                     normalData,
+    __global const uint*                indexData,
+    __global const uint*                uvData,
+    __global const uint*                normalData,
     __global struct Material*           materials,
-    image2d_array_t                     imageArray,
-    sampler_t                           sampler,
-    __global struct AccelStruct*        topLevel)
+    __global const struct TextureInfo*  textureInfos,
+    __global const uchar*               textureData,
+    __global const uint*                texturePageTable,
+    __global uint*                      textureFeedback,
+    __global struct AccelStruct*        topLevel,
+
+    /* push constants */
+    struct RayTraceProperties           RTProp)
 {
-    /* the unique global id of the work item for the current pixel */
-    const int index = get_global_id(0);
+    /* pixel of the current work item, tile swizzled */
+    const int2 pixel = getLaunchID();
+    if (!isLaunchIDValid(pixel, (int)camData->widthPixel, (int)camData->heightPixel))
+        return;
+
+    // Index for accessing image data
+    const int index = getLaunchIndex(pixel, (int)camData->widthPixel);
     const int CHANNEL = 4; // RGBA color output
 
+#ifdef SPEC_MAX_DEPTH
+    const unsigned int maxDepth = SPEC_MAX_DEPTH;
+#else
+    const unsigned int maxDepth = RTProp.depth;
+#endif
+#ifdef SPEC_DEBUG
+    const unsigned int debug = SPEC_DEBUG;
+#else
+    const unsigned int debug = RTProp.debug;
+#endif
+
     // Begin one batch of work
-    int iteration = RTProp->batchSize;
-    unsigned int frameID = RTProp->totalSamples;
+    int iteration = RTProp.batchSize;
+    unsigned int frameID = RTProp.totalSamples;
     while (iteration > 0)
     {
         iteration--;
 
         // ray generation with anti-alising
         float3 rayOrigin, rayDirection;
-        uint3 randInput = {frameID, RTProp->totalSamples, index};
-        generateRay(camData, randInput, &rayOrigin, &rayDirection);
+        uint3 randInput = {frameID, RTProp.totalSamples, index};
+        generateRay(camData, pixel, randInput, &rayOrigin, &rayDirection);
 
         struct Payload payload;
         payload.color[0] = 0.0f;
@@ -212,28 +245,34 @@ __kernel void raygen(
         payload.nextFactor = 1.0f;
         payload.nextRayOrigin = rayOrigin;
         payload.nextRayDirection = rayDirection;
+        payload.coneWidth = 0.0f;
+        payload.coneSpread = getPixelSpread(camData);
 
         struct SceneData sceneData;
         sceneData.camData       = camData;
         sceneData.scene         = scene;
-        sceneData.meshInfoData  = meshInfoData;
-        sceneData.vertexData    = vertexData;
-        sceneData.indexData     = indexData;
-        sceneData.uvData        = uvData;
-        sceneData.normalData    = normalData;
-        sceneData.materials     = materials;
+        sceneData.surfaces.meshInfos = meshInfoData;
+        sceneData.surfaces.vertices  = vertexData;
+        sceneData.surfaces.indices   = indexData;
+        sceneData.surfaces.uvs       = uvData;
+        sceneData.surfaces.normals   = normalData;
+        sceneData.surfaces.materials = materials;
+        sceneData.textures.infos     = textureInfos;
+        sceneData.textures.texels    = textureData;
+        sceneData.textures.pageTable = texturePageTable;
+        sceneData.textures.feedback  = textureFeedback;
         sceneData.topLevel      = topLevel;
         sceneData.depth         = 0;
         sceneData.frameID       = frameID;
-        sceneData.debug         = RTProp->debug;
+        sceneData.debug         = debug;
         
 
         float3 color = 0.0f;
         float3 contribution = 1.0f;
-        while (sceneData.depth < RTProp->depth)
+        while (sceneData.depth < maxDepth)
         {
-            traceRay(topLevel, 1, 3, payload.nextRayOrigin, payload.nextRayDirection,
-                0.001f, 1000, &payload, &sceneData, imageArray, sampler);
+            traceRay(topLevel, vertexData, 1, 3, payload.nextRayOrigin, payload.nextRayDirection,
+                0.001f, 1000, &payload, &sceneData);
 
             if (payload.hit)
             {
@@ -253,7 +292,7 @@ __kernel void raygen(
             sceneData.depth++;
             payload.hit = false;
 
-            if (RTProp->debug)
+            if (debug)
             {
                 break;
             }
@@ -286,7 +325,7 @@ __kernel void raygen(
         imageScratch[CHANNEL * index + 2]
     };
 
-    if (!RTProp->debug)
+    if (!debug)
     {
         // HDR mapping
         // color = reinhard(color);
@@ -305,172 +344,86 @@ __kernel void raygen(
 }
 
 
-inline uint3 getIndices(struct SceneData* sceneData, struct HitData* hitData)
+inline float3 getMatNormal(struct SceneData* sceneData, const struct SurfaceInteraction* si,
+    float coneLod)
 {
-    __global struct MeshInfo* meshInfo = &sceneData->meshInfoData[hitData->instanceIndex];
-    int io = meshInfo->indexOffset;
-    __global uint* indexData = sceneData->indexData;
-
-    uint i0 = indexData[io + hitData->primitiveIndex * 3 + 0];
-    uint i1 = indexData[io + hitData->primitiveIndex * 3 + 1];
-    uint i2 = indexData[io + hitData->primitiveIndex * 3 + 2];
-
-    uint3 indices = {i0, i1, i2};
-    return indices;
-}
-
-inline float2 getUV(struct SceneData* sceneData, struct HitData* hitData)
-{
-    __global struct MeshInfo* meshInfo = &sceneData->meshInfoData[hitData->instanceIndex];
-    int uo = meshInfo->uvOffset;
-    __global float* uvData = sceneData->uvData;
-    uint3 i = getIndices(sceneData, hitData);
-
-    float2 uv0 = {uvData[uo + i.x * 3 + 0], uvData[uo + i.x * 3 + 1]};
-    float2 uv1 = {uvData[uo + i.y * 3 + 0], uvData[uo + i.y * 3 + 1]};
-    float2 uv2 = {uvData[uo + i.z * 3 + 0], uvData[uo + i.z * 3 + 1]};
-    float2 uv  = hitData->barycentric.x * uv0 +
-                 hitData->barycentric.y * uv1 + 
-                 hitData->barycentric.z * uv2;
-    return uv;
-}
-
-inline float3 getFaceNormal(struct SceneData* sceneData, struct HitData* hitData)
-{
-    __global struct MeshInfo* meshInfo = &sceneData->meshInfoData[hitData->instanceIndex];
-    int no = meshInfo->normalOffset;
-    __global float* normalData = sceneData->normalData;
-    uint3 i = getIndices(sceneData, hitData);
-
-    float3 N;
+    float3 N = si->normal;
+    if (SPEC_TEXTURES && si->material.normalTexIdx != -1)
     {
-        float4 n0 = {
-            normalData[no + i.x * 3 + 0],
-            normalData[no + i.x * 3 + 1],
-            normalData[no + i.x * 3 + 2], 0.0f};
-        float4 n1 = {
-            normalData[no + i.y * 3 + 0],
-            normalData[no + i.y * 3 + 1],
-            normalData[no + i.y * 3 + 2], 0.0f};
-        float4 n2 = {
-            normalData[no + i.z * 3 + 0],
-            normalData[no + i.z * 3 + 1],
-            normalData[no + i.z * 3 + 2], 0.0f};
-        float4 normal = hitData->barycentric.x * n0 +
-                        hitData->barycentric.y * n1 + 
-                        hitData->barycentric.z * n2;
-        float4 tmp;
-        MultiplyMat4Vec4(&hitData->transform, &normal, &tmp);
-        N = normalize(tmp.xyz);
-    }
-    return N;
-}
-
-inline float3 getMatNormal(struct SceneData* sceneData, struct HitData* hitData,
-    image2d_array_t imageArray, sampler_t sampler, float3 faceNormal)
-{
-    __global struct MeshInfo* meshInfo = &sceneData->meshInfoData[hitData->instanceIndex];
-    __global struct Material* material = &sceneData->materials[meshInfo->materialIndex];
-
-    if (material->normalTexIdx != -1)
-    {
-        float2 uv = getUV(sceneData, hitData);
-        float4 coord = {uv.x, 1.0f - uv.y, (float)material->normalTexIdx, 0.0f};
-        uint4 tex = 0.0f;//read_imageui(imageArray, sampler, coord);
-        float4 localNormal = {
-            clamp(tex.x / 255.0f, 0.0f, 1.0f),
-            clamp(tex.y / 255.0f, 0.0f, 1.0f),
-            clamp(tex.z / 255.0f, 0.0f, 1.0f),
-            0.0f
-        };
+        float2 coord = {si->uv.x, 1.0f - si->uv.y};
+        float4 tex = textureSampleCone(&sceneData->textures,
+            si->material.normalTexIdx, coord, coneLod);
+        float4 localNormal = {tex.x, tex.y, tex.z, 0.0f};
         localNormal = normalize(localNormal * 2.0f - 1.0f);
         mat4x4 transform;
-        GetNormalSpace(faceNormal, &transform);
+        GetNormalSpace(N, &transform);
         float4 globalNormal;
         MultiplyMat4Vec4(&transform, &localNormal, &globalNormal);
-        faceNormal = normalize(globalNormal.xyz);
+        N = normalize(globalNormal.xyz);
     }
 
-    return faceNormal;
+    return N;
 }
 
 // float4: {metallicFrag, roughnessFrag, transmissionFrag, iorFrag}
-inline float4 getMaterialProp(struct SceneData* sceneData, struct HitData* hitData,
-    image2d_array_t imageArray, sampler_t sampler)
+inline float4 getMaterialProp(struct SceneData* sceneData, const struct SurfaceInteraction* si,
+    float coneLod)
 {
-    __global struct MeshInfo* meshInfo = &sceneData->meshInfoData[hitData->instanceIndex];
-    __global struct Material* material = &sceneData->materials[meshInfo->materialIndex];
-    float2 uv = getUV(sceneData, hitData);
+    float2 coord = {si->uv.x, 1.0f - si->uv.y};
 
     float metallicFrag;
-    if (material->metallicTexIdx == -1)
-        metallicFrag = material->metallic;
+    if (!SPEC_TEXTURES || si->material.metallicTexIdx == -1)
+        metallicFrag = si->material.metallic;
     else
     {
-        float4 coord = {uv.x, 1.0f - uv.y, (float)material->metallicTexIdx, 0.0f};
-        uint4 tex = 0.0f;//read_imageui(imageArray, sampler, coord);
-        metallicFrag = clamp(tex.z / 255.0f, 0.0f, 1.0f);
+        float4 tex = textureSampleCone(&sceneData->textures,
+            si->material.metallicTexIdx, coord, coneLod);
+        metallicFrag = clamp(tex.z, 0.0f, 1.0f);
     }
 
     float roughnessFrag;
-    if (material->roughnessTexIdx == -1)
-        roughnessFrag = clamp(material->roughness, 0.0f, 1.0f);
+    if (!SPEC_TEXTURES || si->material.roughnessTexIdx == -1)
+        roughnessFrag = clamp(si->material.roughness, 0.0f, 1.0f);
     else
     {
-        float4 coord = {uv.x, 1.0f - uv.y, (float)material->roughnessTexIdx, 0.0f};
-        uint4 tex = 0.0f;//read_imageui(imageArray, sampler, coord);
-        roughnessFrag = clamp(tex.y / 255.0f, 0.05f, 1.0f);
+        float4 tex = textureSampleCone(&sceneData->textures,
+            si->material.roughnessTexIdx, coord, coneLod);
+        roughnessFrag = clamp(tex.y, 0.05f, 1.0f);
     }
 
-    float transFrag = clamp(material->transmission, 0.0f, 1.0f);
-    float iorFrag = clamp(material->ior, 0.0f, 10.0f);
+    float transFrag = SPEC_TRANSMISSION ? clamp(si->material.transmission, 0.0f, 1.0f) : 0.0f;
+    float iorFrag = clamp(si->material.ior, 0.0f, 10.0f);
 
     float4 matProp = {metallicFrag, roughnessFrag, transFrag, iorFrag};
     return matProp;
 }
 
-inline float3 getAlbedo(struct SceneData* sceneData, struct HitData* hitData,
-    image2d_array_t imageArray, sampler_t sampler)
+inline float3 getAlbedo(struct SceneData* sceneData, const struct SurfaceInteraction* si,
+    float coneLod)
 {
-    __global struct MeshInfo* meshInfo = &sceneData->meshInfoData[hitData->instanceIndex];
-    __global struct Material* material = &sceneData->materials[meshInfo->materialIndex];
-    float2 uv = getUV(sceneData, hitData);
-
     float3 albedoFrag;
-    if (material->albedoTexIdx == -1)
-        albedoFrag = material->albedo.rgb;
+    if (!SPEC_TEXTURES || si->material.albedoTexIdx == -1)
+        albedoFrag = si->material.albedo.rgb;
     else
     {
-        float4 coord = {uv.x, 1.0f - uv.y, (float)material->albedoTexIdx, 0.0f};
-        uint4 tex = 0.0f;//read_imageui(imageArray, sampler, coord);
-        albedoFrag.x = clamp(tex.x / 255.0f, 0.0f, 1.0f);
-        albedoFrag.y = clamp(tex.y / 255.0f, 0.0f, 1.0f);
-        albedoFrag.z = clamp(tex.z / 255.0f, 0.0f, 1.0f);
+        float2 coord = {si->uv.x, 1.0f - si->uv.y};
+        float4 tex = textureSampleCone(&sceneData->textures,
+            si->material.albedoTexIdx, coord, coneLod);
+        albedoFrag = clamp(tex.xyz, 0.0f, 1.0f);
     }
     return albedoFrag;
 }
 
-inline float3 getHitPosition(struct HitData* hitData, float3 N)
+// Offset along N so secondary rays do not hit the surface they start on
+inline float3 getHitPosition(const struct SurfaceInteraction* si, float3 N)
 {
-    // Get global hit position
-    float3 hitPos;
-    {
-        float4 tmp0;
-        float4 tmp1 = {
-            hitData->hitPoint.x,
-            hitData->hitPoint.y,
-            hitData->hitPoint.z, 1.0f
-        };
-        MultiplyMat4Vec4(&hitData->transform, &tmp1, &tmp0);
-        hitPos = tmp0.xyz + N * 0.00001f;
-    }
-    return hitPos;
+    return si->position + N * 0.00001f;
 }
 
-inline float3 getLightDirection(struct SceneData* sceneData)
+inline float3 getLightDirection(struct SceneData* sceneData, uint lightIndex)
 {
     __global struct SceneProperties* scene = sceneData->scene;
-    float3 L = normalize(-scene->lights[0].direction.xyz);
+    float3 L = normalize(-scene->lights[lightIndex].direction.xyz);
     return L;
 }
 
@@ -480,32 +433,46 @@ inline float3 getViewDirection(struct Payload* payload)
 }
 
 void material(struct Payload* payload, struct HitData* hitData,
-    struct SceneData* sceneData, image2d_array_t imageArray, sampler_t sampler)
+    struct SceneData* sceneData)
 {
     payload->hit = true;
 
-    float3 faceN = getFaceNormal(sceneData, hitData);
-    float3 hitPos = getHitPosition(hitData, faceN);
-    
-    float3 N = getMatNormal(sceneData, hitData, imageArray, sampler, faceN);
-    float3 L = getLightDirection(sceneData);
+    // Indices, attributes and material are read once for the whole hit
+    struct SurfaceInteraction si = getSurfaceInteraction(&sceneData->surfaces, hitData, SPEC_TEXTURES);
+    float3 faceN = si.normal;
+    float3 hitPos = getHitPosition(&si, faceN);
+
+    float coneLod = surfaceConeLod(&si,
+        payload->coneWidth + payload->coneSpread * hitData->distance, payload->nextRayDirection);
+    float3 N = getMatNormal(sceneData, &si, coneLod);
     float3 V = getViewDirection(payload);
 
     // float4 mat <x,y,z,w> := <metallic, roughness, transmission, ior>
-    float4 mat = getMaterialProp(sceneData, hitData, imageArray, sampler);
-    float3 albedo = getAlbedo(sceneData, hitData, imageArray, sampler);
+    float4 mat = getMaterialProp(sceneData, &si, coneLod);
+    float3 albedo = getAlbedo(sceneData, &si, coneLod);
 
-    // Shadow test 
-    struct Payload shadowPayload;
-    traceRay(sceneData->topLevel, 2, 4, hitPos, L, 0.001f, 1000,
-        &shadowPayload, sceneData, imageArray, sampler);
+#ifdef SPEC_LIGHT_COUNT
+    const uint lightCount = SPEC_LIGHT_COUNT;
+#else
+    const uint lightCount = sceneData->scene->lightCount.x;
+#endif
 
     float3 color = {0.0f, 0.0f, 0.0f};
-    if (!shadowPayload.hit) // TODO: support multiple lights
+    for (uint i = 0; i < lightCount; i++)
     {
-        __global struct SceneProperties* scene = sceneData->scene;
-        float3 radiance = scene->lights[0].color.rgb; // dot is included in brdf
-        color += microfacetBRDF(L, V, N, albedo, mat.x, mat.y, mat.z, mat.w) * radiance;
+        float3 L = getLightDirection(sceneData, i);
+
+        // Shadow test 
+        struct Payload shadowPayload;
+        traceRay(sceneData->topLevel, sceneData->surfaces.vertices, 2, 4, hitPos, L, 0.001f, 1000,
+            &shadowPayload, sceneData);
+
+        if (!shadowPayload.hit)
+        {
+            __global struct SceneProperties* scene = sceneData->scene;
+            float3 radiance = scene->lights[i].color.rgb; // dot is included in brdf
+            color += microfacetBRDF(L, V, N, albedo, mat.x, mat.y, mat.z, mat.w) * radiance;
+        }
     }
 
     // Combine with ambient
@@ -520,7 +487,7 @@ void material(struct Payload* payload, struct HitData* hitData,
     ////////////////////////////////////////
 
     // different random value for each pixel and each frame
-    uint3 randInput = {sceneData->frameID, (uint)get_global_id(0), sceneData->depth};
+    uint3 randInput = {sceneData->frameID, getLaunchLinearID(), sceneData->depth};
     float3 random = random_pcg3d(randInput);
     
     // sample indirect direction
@@ -528,27 +495,32 @@ void material(struct Payload* payload, struct HitData* hitData,
     float3 nextDir = sampleMicrofacetBRDF_transm(V, N, albedo,
         mat.x, mat.y, mat.z, mat.w, random, &nextFactor);
     if (dot(nextDir, N) < 0)
-        hitPos = getHitPosition(hitData, -faceN);
+        hitPos = getHitPosition(&si, -faceN);
     
     // indirect ray
     payload->nextRayOrigin = hitPos;
     payload->nextRayDirection = nextDir;
     payload->nextFactor = nextFactor;
 
+    // The cone continues from its footprint here. Without curvature data the
+    // surface spread angle comes from the roughness, wide lobes blur more.
+    payload->coneWidth += payload->coneSpread * hitData->distance;
+    payload->coneSpread += 2.0f * mat.y * mat.y;
+
     ////////////////////////////////////////
     //      Global illumination End       //
     ////////////////////////////////////////
 }
 
 void shadowMiss(struct Payload* payload,
-    struct SceneData* sceneData, image2d_array_t imageArray, sampler_t sampler)
+    struct SceneData* sceneData)
 {
     payload->hit = false;
     payload->color = 1.0f;
 }
 
 void environment(struct Payload* payload,
-    struct SceneData* sceneData, image2d_array_t imageArray, sampler_t sampler)
+    struct SceneData* sceneData)
 {
     payload->hit = false;
     payload->color.x = 0.2f;
@@ -557,7 +529,7 @@ void environment(struct Payload* payload,
 }
 
 void shadow(struct Payload* payload, struct HitData* hitData,
-    struct SceneData* sceneData, image2d_array_t imageArray, sampler_t sampler)
+    struct SceneData* sceneData)
 {
     // Shadow test
     payload->hit = true;
@@ -565,45 +537,12 @@ void shadow(struct Payload* payload, struct HitData* hitData,
 }
 
 void anyShadow(bool* cont, struct Payload* payload, struct HitData* hitData,
-    struct SceneData* sceneData, image2d_array_t imageArray, sampler_t sampler)
+    struct SceneData* sceneData)
 {
     // Shadow test
     *cont = false;
 }
 
-void callAnyHit(bool* cont, int sbtRecordOffset, struct Payload* payload, struct HitData* hitData,
-    struct SceneData* sceneData, image2d_array_t imageArray, sampler_t sampler)
-{
-
-    int index = hitData->instanceSBTOffset + sbtRecordOffset;
-    switch (index)
-    {
-		case 2:anyShadow(cont, payload, hitData, sceneData, imageArray, sampler);break;
-    }
-}
-
-void callHit(int sbtRecordOffset, struct Payload* payload, struct HitData* hitData,
-    struct SceneData* sceneData, image2d_array_t imageArray, sampler_t sampler)
-{
-    int index = hitData->instanceSBTOffset + sbtRecordOffset;
-    switch (index)
-    {
-		case 1:material(payload, hitData, sceneData, imageArray, sampler);break;
-		case 2:shadow(payload, hitData, sceneData, imageArray, sampler);break;
-    }
-}
-
-
-void callMiss(int missIndex, struct Payload* payload,
-    struct SceneData* sceneData, image2d_array_t imageArray, sampler_t sampler)
-{
-    switch (missIndex)
-    {
-		case 3:environment(payload, sceneData, imageArray, sampler);break;
-		case 4:shadowMiss(payload, sceneData, imageArray, sampler);break;
-    }
-}
-
 //    if (sceneData->debug == 1)
 //     {
 //         // [debug] normal viz
@@ -634,8 +573,8 @@ void callMiss(int missIndex, struct Payload* payload,
 //     {
 //         // Shadow test: white color if no occlusion
 //         struct Payload shadowPayload;
-//         traceRay(sceneData->topLevel, 2, 4, hitPos, L, 0.01, 1000, &shadowPayload,
-//             sceneData, imageArray, sampler);
+//         traceRay(sceneData->topLevel, sceneData->surfaces.vertices, 2, 4, hitPos, L, 0.01, 1000, &shadowPayload,
+//             sceneData);
 //         payload->color = shadowPayload.color;
 //     }
 //     else if (sceneData->debug == 7)
@@ -23,6 +23,7 @@ struct SceneData
     uint*                      indexData;
     struct Material*           materials;
     struct SceneProperties*    scene;
+    struct TextureTable        textures;
     int                        depth;
     unsigned int               frameID;
     unsigned int               debug;
@@ -41,16 +42,19 @@ __kernel void raygen(
     __global uint*                      indexData,
     __global struct Material*           materials,
     __global struct SceneProperties*    scene,
-    image2d_array_t                     imageArray,
-    sampler_t                           sampler,
+    __global const struct TextureInfo*  textureInfos,
+    __global const uchar*               textureData,
     __global struct AccelStruct*        topLevel)
 {
-    /* the unique global id of the work item for the current pixel */
-    const int index = get_global_id(0);
+    /* pixel of the current work item, tile swizzled */
+    const int2 pixel = getLaunchID();
+    if (!isLaunchIDValid(pixel, (int)extent[0], (int)extent[1]))
+        return;
 
     // Index for accessing image data
-    const int x = index % (int)extent[0]; /* x-coordinate of the pixel */
-    const int y = index / (int)extent[0]; /* y-coordinate of the pixel */
+    const int index = getLaunchIndex(pixel, (int)extent[0]);
+    const int x = pixel.x; /* x-coordinate of the pixel */
+    const int y = pixel.y; /* y-coordinate of the pixel */
 
     const int CHANNEL = 4; // RGBA color output
 
@@ -100,6 +104,10 @@ __kernel void raygen(
         sceneData.indexData     = indexData;
         sceneData.materials     = materials;
         sceneData.scene         = scene;
+        sceneData.textures.infos  = textureInfos;
+        sceneData.textures.texels = textureData;
+        sceneData.textures.pageTable = 0; // not virtual
+        sceneData.textures.feedback  = 0;
         sceneData.depth         = 0;
         sceneData.frameID       = frameID;
         sceneData.debug         = RTProp->debug;
@@ -110,8 +118,8 @@ __kernel void raygen(
 
         while (sceneData.depth < RTProp->depth)
         {
-            traceRay(topLevel, 1, 3, payload.nextRayOrigin, payload.nextRayDirection,
-                0.01, 1000, &payload, &sceneData, imageArray, sampler);
+            traceRay(topLevel, vertexData, 1, 3, payload.nextRayOrigin, payload.nextRayDirection,
+                0.01, 1000, &payload, &sceneData);
 
             if (payload.hit)
             {
@@ -197,7 +205,7 @@ __kernel void raygen(
 // }
 
 void shadow(struct Payload* payload, struct HitData* hitData,
-    struct SceneData* sceneData, image2d_array_t imageArray, sampler_t sampler)
+    struct SceneData* sceneData)
 {
     // Shadow test
     payload->hit = true;
@@ -205,7 +213,7 @@ void shadow(struct Payload* payload, struct HitData* hitData,
 }
 
 void material(struct Payload* payload, struct HitData* hitData,
-    struct SceneData* sceneData, image2d_array_t imageArray, sampler_t sampler)
+    struct SceneData* sceneData)
 {
     payload->hit = true;
 
@@ -257,11 +265,8 @@ void material(struct Payload* payload, struct HitData* hitData,
                     hitData->barycentric.y * uv1 + 
                     hitData->barycentric.z * uv2;
 
-        float4 coord = {uv.x, 1.0f - uv.y, 0.0f, 0.0f};
-        uint4 texCol = read_imageui(imageArray, sampler, coord);
-        albedoFrag.x = texCol.x / 255.0f;
-        albedoFrag.y = texCol.y / 255.0f;
-        albedoFrag.z = texCol.z / 255.0f;
+        float2 coord = {uv.x, 1.0f - uv.y};
+        albedoFrag = textureSample(&sceneData->textures, 0, coord).xyz;
     }
 
     struct SceneProperties* scene = sceneData->scene;
@@ -281,8 +286,8 @@ void material(struct Payload* payload, struct HitData* hitData,
 
     // Shadow test 
     struct Payload shadowPayload;
-    traceRay(sceneData->topLevel, 2, 4, origin, L, 0.01, 1000, &shadowPayload,
-        sceneData, imageArray, sampler);
+    traceRay(sceneData->topLevel, sceneData->vertexData, 2, 4, origin, L, 0.01, 1000, &shadowPayload,
+        sceneData);
 
     float3 color = {0.0f, 0.0f, 0.0f};
     if (!shadowPayload.hit)
@@ -309,7 +314,7 @@ void material(struct Payload* payload, struct HitData* hitData,
     ////////////////////////////////////////
 
     // different random value for each pixel and each frame
-    uint3 randInput = {sceneData->frameID, (uint)get_global_id(0), sceneData->depth};
+    uint3 randInput = {sceneData->frameID, getLaunchLinearID(), sceneData->depth};
     float3 random = random_pcg3d(randInput);
     // printf("input: <%d, %d, %d>\nrandom: <%f, %f, %f>\n",
     //     randInput.x, randInput.y, randInput.z,
@@ -360,8 +365,8 @@ void material(struct Payload* payload, struct HitData* hitData,
     {
         // Shadow test: white color if no occlusion
         struct Payload shadowPayload;
-        traceRay(sceneData->topLevel, 2, 4, origin, L, 0.01, 1000, &shadowPayload,
-            sceneData, imageArray, sampler);
+        traceRay(sceneData->topLevel, sceneData->vertexData, 2, 4, origin, L, 0.01, 1000, &shadowPayload,
+            sceneData);
         payload->color = shadowPayload.color;
     }
     else if (sceneData->debug == 7)
@@ -378,14 +383,14 @@ void material(struct Payload* payload, struct HitData* hitData,
 }
 
 void shadowMiss(struct Payload* payload,
-    struct SceneData* sceneData, image2d_array_t imageArray, sampler_t sampler)
+    struct SceneData* sceneData)
 {
     payload->hit = false;
     payload->color = 1.0f;
 }
 
 void environment(struct Payload* payload,
-    struct SceneData* sceneData, image2d_array_t imageArray, sampler_t sampler)
+    struct SceneData* sceneData)
 {
     payload->hit = false;
     payload->color.x = 0.2;
@@ -395,13 +400,13 @@ void environment(struct Payload* payload,
 
 
 void callHit(int sbtRecordOffset, struct Payload* payload, struct HitData* hitData,
-    struct SceneData* sceneData, image2d_array_t imageArray, sampler_t sampler)
+    struct SceneData* sceneData)
 {
     int index = hitData->instanceSBTOffset + sbtRecordOffset;
     switch (index)
     {
-		case 1:material(payload, hitData, sceneData, imageArray, sampler);break;
-		case 2:shadow(payload, hitData, sceneData, imageArray, sampler);break;
+		case 1:material(payload, hitData, sceneData);break;
+		case 2:shadow(payload, hitData, sceneData);break;
 
         default: printf("Error: No hit shader found.");
     }
@@ -409,12 +414,12 @@ void callHit(int sbtRecordOffset, struct Payload* payload, struct HitData* hitDa
 
 
 void callMiss(int missIndex, struct Payload* payload,
-    struct SceneData* sceneData, image2d_array_t imageArray, sampler_t sampler)
+    struct SceneData* sceneData)
 {
     switch (missIndex)
     {
-		case 3:environment(payload, sceneData, imageArray, sampler);break;
-		case 4:shadowMiss(payload, sceneData, imageArray, sampler);break;
+		case 3:environment(payload, sceneData);break;
+		case 4:shadowMiss(payload, sceneData);break;
 
         default: printf("Error: No miss shader found.");
     }
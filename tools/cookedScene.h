@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstdint>
+
+// Cooked scene file, written by sceneCooker and memory-mapped by Scene::LoadCooked().
+//
+// [CookedSceneHeader][pad][section 0][pad][section 1]...
+//
+// Every section starts on a COOKED_SCENE_ALIGN boundary so it can be uploaded
+// straight from the mapping. Sections hold the host arrays of SceneHostData as is,
+// except the packed attribute streams of PackAttributes() for indices, UVs and normals.
+// The accel struct section is the blob returned by ReadTopAccelStruct().
+
+#define COOKED_SCENE_MAGIC   0x4e435352 // "RSCN"
+#define COOKED_SCENE_VERSION 5
+#define COOKED_SCENE_ALIGN   4096
+
+namespace RD
+{
+
+enum CookedSection
+{
+    COOKED_MESH_INFO,
+    COOKED_VERTEX,
+    COOKED_INDEX,
+    COOKED_UV,
+    COOKED_NORMAL,
+    COOKED_MATERIAL,
+    COOKED_TEXTURE_INFO,
+    COOKED_TEXTURE,
+    COOKED_ACCEL_STRUCT,
+    COOKED_SECTION_COUNT
+};
+
+struct CookedSectionDesc
+{
+    uint64_t offset; // bytes from the start of the file
+    uint64_t size;
+};
+
+struct CookedSceneHeader
+{
+    uint32_t magic;
+    uint32_t version;
+
+    // Host struct sizes at cook time, a mismatch means the file is stale
+    uint32_t meshInfoSize;
+    uint32_t materialSize;
+    uint32_t textureInfoSize;
+
+    uint32_t textureCount;
+    uint32_t hasTextures;
+    uint32_t hasTransmission;
+
+    // Model the scene was cooked from, a different size or mtime means it was edited since
+    uint64_t sourceSize;
+    int64_t sourceMtime;
+
+    CookedSectionDesc sections[COOKED_SECTION_COUNT];
+};
+
+} // namespace RD
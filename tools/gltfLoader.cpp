@@ -0,0 +1,752 @@
+#include "gltfLoader.h"
+#include "threadPool.h"
+
+#include <atomic>
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+
+#define GLB_MAGIC        0x46546C67 // "glTF"
+#define GLB_CHUNK_JSON   0x4E4F534A
+#define GLB_CHUNK_BIN    0x004E4942
+
+#define GLTF_BYTE           5120
+#define GLTF_UNSIGNED_BYTE  5121
+#define GLTF_SHORT          5122
+#define GLTF_UNSIGNED_SHORT 5123
+#define GLTF_UNSIGNED_INT   5125
+#define GLTF_FLOAT          5126
+
+#define GLTF_MODE_TRIANGLES 4
+
+#define GLTF_NEAREST         9728
+#define GLTF_CLAMP_TO_EDGE   33071
+#define GLTF_MIRRORED_REPEAT 33648
+
+
+namespace RD
+{
+
+// Minimal JSON DOM, enough for the glTF header
+struct JsonValue
+{
+    enum Type { JSON_NULL, JSON_BOOL, JSON_NUMBER, JSON_STRING, JSON_ARRAY, JSON_OBJECT };
+
+    Type type = JSON_NULL;
+    double number = 0.0;
+    std::string string;
+    std::vector<JsonValue> array;
+    std::vector<std::pair<std::string, JsonValue>> object;
+
+    // Missing keys and out of range indices return a null value
+    const JsonValue& operator[](const char* key) const
+    {
+        static const JsonValue null;
+        for (const auto& [name, value]: object)
+            if (name == key) return value;
+        return null;
+    }
+
+    const JsonValue& operator[](int index) const
+    {
+        static const JsonValue null;
+        return index >= 0 && (size_t)index < array.size() ? array[index] : null;
+    }
+
+    bool IsNull() const { return type == JSON_NULL; }
+    size_t Size() const { return array.size(); }
+    double Number(double fallback) const { return type == JSON_NUMBER ? number : fallback; }
+    int Int(int fallback) const { return type == JSON_NUMBER ? (int)number : fallback; }
+    size_t Unsigned(size_t fallback) const { return type == JSON_NUMBER ? (size_t)number : fallback; }
+};
+
+struct JsonParser
+{
+    const char* p;
+    const char* end;
+
+    void SkipSpace()
+    {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r'))
+            p++;
+    }
+
+    bool Expect(char c)
+    {
+        SkipSpace();
+        if (p < end && *p == c) { p++; return true; }
+        return false;
+    }
+
+    bool Literal(const char* text)
+    {
+        size_t length = strlen(text);
+        if ((size_t)(end - p) < length || strncmp(p, text, length) != 0)
+            return false;
+        p += length;
+        return true;
+    }
+
+    bool ParseString(std::string& out)
+    {
+        if (!Expect('"'))
+            return false;
+
+        while (p < end && *p != '"')
+        {
+            char c = *p++;
+            if (c != '\\')
+            {
+                out += c;
+                continue;
+            }
+            if (p >= end)
+                return false;
+
+            c = *p++;
+            switch (c)
+            {
+            case 'b': out += '\b'; break;
+            case 'f': out += '\f'; break;
+            case 'n': out += '\n'; break;
+            case 'r': out += '\r'; break;
+            case 't': out += '\t'; break;
+            case 'u':
+            {
+                if (end - p < 4)
+                    return false;
+                unsigned int code = strtoul(std::string(p, 4).c_str(), nullptr, 16);
+                p += 4;
+                // Basic plane only, names in glTF files are plain ASCII in practice
+                if (code < 0x80)
+                    out += (char)code;
+                else if (code < 0x800)
+                {
+                    out += (char)(0xC0 | (code >> 6));
+                    out += (char)(0x80 | (code & 0x3F));
+                }
+                else
+                {
+                    out += (char)(0xE0 | (code >> 12));
+                    out += (char)(0x80 | ((code >> 6) & 0x3F));
+                    out += (char)(0x80 | (code & 0x3F));
+                }
+                break;
+            }
+            default: out += c; break; // \" \\ \/
+            }
+        }
+        return Expect('"');
+    }
+
+    bool ParseValue(JsonValue& value)
+    {
+        SkipSpace();
+        if (p >= end)
+            return false;
+
+        switch (*p)
+        {
+        case '{':
+            p++;
+            value.type = JsonValue::JSON_OBJECT;
+            if (Expect('}'))
+                return true;
+            do
+            {
+                std::pair<std::string, JsonValue> member;
+                if (!ParseString(member.first) || !Expect(':') || !ParseValue(member.second))
+                    return false;
+                value.object.push_back(std::move(member));
+            } while (Expect(','));
+            return Expect('}');
+
+        case '[':
+            p++;
+            value.type = JsonValue::JSON_ARRAY;
+            if (Expect(']'))
+                return true;
+            do
+            {
+                value.array.emplace_back();
+                if (!ParseValue(value.array.back()))
+                    return false;
+            } while (Expect(','));
+            return Expect(']');
+
+        case '"':
+            value.type = JsonValue::JSON_STRING;
+            return ParseString(value.string);
+
+        case 't':
+            value.type = JsonValue::JSON_BOOL;
+            value.number = 1.0;
+            return Literal("true");
+
+        case 'f':
+            value.type = JsonValue::JSON_BOOL;
+            return Literal("false");
+
+        case 'n':
+            return Literal("null");
+
+        default:
+        {
+            // The chunk is not null terminated, strtod needs a bounded copy
+            const char* start = p;
+            while (p < end && *p && strchr("+-0123456789.eE", *p))
+                p++;
+            if (p == start)
+                return false;
+            value.type = JsonValue::JSON_NUMBER;
+            value.number = strtod(std::string(start, p).c_str(), nullptr);
+            return true;
+        }
+        }
+    }
+};
+
+// Typed view of an accessor inside the binary chunk
+struct GltfAccessor
+{
+    const unsigned char* data;
+    size_t count;
+    size_t stride;
+    int componentType;
+    int components;
+    bool normalized;
+
+    float Float(size_t index, int component) const
+    {
+        const unsigned char* element = data + index * stride;
+        switch (componentType)
+        {
+        case GLTF_FLOAT:
+        {
+            float value;
+            memcpy(&value, element + component * 4, 4);
+            return value;
+        }
+        case GLTF_UNSIGNED_BYTE:
+            return normalized ? element[component] / 255.0f : element[component];
+        case GLTF_BYTE:
+        {
+            float value = (int8_t)element[component];
+            return normalized ? std::max(value / 127.0f, -1.0f) : value;
+        }
+        case GLTF_UNSIGNED_SHORT:
+        {
+            uint16_t value;
+            memcpy(&value, element + component * 2, 2);
+            return normalized ? value / 65535.0f : value;
+        }
+        case GLTF_SHORT:
+        {
+            int16_t value;
+            memcpy(&value, element + component * 2, 2);
+            return normalized ? std::max(value / 32767.0f, -1.0f) : value;
+        }
+        default:
+            return 0.0f;
+        }
+    }
+
+    unsigned int Index(size_t index) const
+    {
+        const unsigned char* element = data + index * stride;
+        switch (componentType)
+        {
+        case GLTF_UNSIGNED_BYTE:
+            return element[0];
+        case GLTF_UNSIGNED_SHORT:
+        {
+            uint16_t value;
+            memcpy(&value, element, 2);
+            return value;
+        }
+        default:
+        {
+            uint32_t value;
+            memcpy(&value, element, 4);
+            return value;
+        }
+        }
+    }
+};
+
+struct GltfFile
+{
+    JsonValue json;
+    const unsigned char* bin = nullptr;
+    size_t binSize = 0;
+};
+
+// One glTF primitive becomes one mesh, as with the Assimp importer
+struct GltfPrimitive
+{
+    GltfAccessor position;
+    GltfAccessor normal;
+    GltfAccessor uv;
+    GltfAccessor indices;
+    bool hasNormal;
+    bool hasUV;
+    bool hasIndices;
+};
+
+// Bounds checked view of a bufferView, nullptr if it is not in the binary chunk
+const unsigned char* _bufferView(const GltfFile& gltf, int index, size_t* size, size_t* stride)
+{
+    const JsonValue& view = gltf.json["bufferViews"][index];
+    if (view.IsNull())
+        return nullptr;
+
+    const JsonValue& buffer = gltf.json["buffers"][view["buffer"].Int(0)];
+    if (buffer.IsNull() || !buffer["uri"].IsNull())
+        return nullptr; // external buffers are left to Assimp
+
+    size_t offset = view["byteOffset"].Unsigned(0);
+    size_t length = view["byteLength"].Unsigned(0);
+    if (offset > gltf.binSize || length > gltf.binSize - offset)
+        return nullptr;
+
+    *size = length;
+    if (stride)
+        *stride = view["byteStride"].Unsigned(0);
+    return gltf.bin + offset;
+}
+
+bool _accessor(const GltfFile& gltf, int index, GltfAccessor& out)
+{
+    const JsonValue& accessor = gltf.json["accessors"][index];
+    if (accessor.IsNull() || !accessor["sparse"].IsNull())
+        return false;
+
+    const std::string& type = accessor["type"].string;
+    out.components = type == "SCALAR" ? 1 : type == "VEC2" ? 2 :
+        type == "VEC3" ? 3 : type == "VEC4" ? 4 : 0;
+    out.componentType = accessor["componentType"].Int(0);
+    out.normalized = accessor["normalized"].number != 0.0;
+    out.count = accessor["count"].Unsigned(0);
+
+    size_t componentSize;
+    switch (out.componentType)
+    {
+    case GLTF_BYTE: case GLTF_UNSIGNED_BYTE: componentSize = 1; break;
+    case GLTF_SHORT: case GLTF_UNSIGNED_SHORT: componentSize = 2; break;
+    case GLTF_UNSIGNED_INT: case GLTF_FLOAT: componentSize = 4; break;
+    default: return false;
+    }
+
+    size_t viewSize, viewStride;
+    const unsigned char* view = _bufferView(gltf,
+        accessor["bufferView"].Int(-1), &viewSize, &viewStride);
+    if (view == nullptr || out.components == 0)
+        return false;
+
+    size_t elementSize = componentSize * out.components;
+    size_t offset = accessor["byteOffset"].Unsigned(0);
+    out.stride = viewStride ? viewStride : elementSize;
+    out.data = view + offset;
+
+    return out.count == 0 ||
+        (offset <= viewSize && out.stride * (out.count - 1) + elementSize <= viewSize - offset);
+}
+
+// Image index of a texture, the texture table entry it is loaded into
+int _textureImage(const GltfFile& gltf, const JsonValue& textureInfo)
+{
+    if (textureInfo.IsNull())
+        return -1;
+    const JsonValue& texture = gltf.json["textures"][textureInfo["index"].Int(-1)];
+    return texture["source"].Int(-1);
+}
+
+// Sampler modes of the first texture using each image, the table holds one entry per image.
+// Wrap T and the minification filter follow wrap S and the magnification filter.
+void _textureSamplers(const GltfFile& gltf, std::vector<TextureLevels>& textures)
+{
+    std::vector<bool> assigned(textures.size(), false);
+    const JsonValue& gltfTextures = gltf.json["textures"];
+    for (size_t i = 0; i < gltfTextures.Size(); i++)
+    {
+        int image = gltfTextures[i]["source"].Int(-1);
+        if (image < 0 || image >= (int)textures.size() || assigned[image])
+            continue;
+        assigned[image] = true;
+
+        const JsonValue& sampler = gltf.json["samplers"][gltfTextures[i]["sampler"].Int(-1)];
+        int wrap = sampler["wrapS"].Int(0);
+        textures[image].addressMode =
+            wrap == GLTF_CLAMP_TO_EDGE ? RD_ADDRESS_CLAMP_TO_EDGE :
+            wrap == GLTF_MIRRORED_REPEAT ? RD_ADDRESS_MIRRORED_REPEAT : RD_ADDRESS_REPEAT;
+        textures[image].filterMode =
+            sampler["magFilter"].Int(0) == GLTF_NEAREST ? RD_FILTER_NEAREST : RD_FILTER_LINEAR;
+    }
+}
+
+Material _material(const GltfFile& gltf, const JsonValue& mat)
+{
+    const JsonValue& pbr = mat["pbrMetallicRoughness"];
+    Material material;
+
+    const JsonValue& baseColor = pbr["baseColorFactor"];
+    for (int c = 0; c < 4; c++)
+        material.albedo[c] = baseColor[c].Number(1.0);
+    material.albedoTexIdx = _textureImage(gltf, pbr["baseColorTexture"]);
+
+    // Metallic in blue, roughness in green of the same texture
+    int metallicRoughness = _textureImage(gltf, pbr["metallicRoughnessTexture"]);
+    material.metallic = pbr["metallicFactor"].Number(1.0);
+    material.roughness = pbr["roughnessFactor"].Number(1.0);
+    material.metallicTexIdx = metallicRoughness;
+    material.roughnessTexIdx = metallicRoughness;
+
+    const JsonValue& extensions = mat["extensions"];
+    material.transmission = extensions["KHR_materials_transmission"]["transmissionFactor"].Number(0.0);
+    material.ior = extensions["KHR_materials_ior"]["ior"].Number(1.45);
+
+    material.normalTexIdx = _textureImage(gltf, mat["normalTexture"]);
+    return material;
+}
+
+bool _primitive(const GltfFile& gltf, const JsonValue& primitive, GltfPrimitive& out)
+{
+    if (primitive["mode"].Int(GLTF_MODE_TRIANGLES) != GLTF_MODE_TRIANGLES)
+        return false;
+
+    const JsonValue& attributes = primitive["attributes"];
+    if (!_accessor(gltf, attributes["POSITION"].Int(-1), out.position) ||
+        out.position.componentType != GLTF_FLOAT || out.position.components != 3)
+        return false;
+
+    out.hasNormal = !attributes["NORMAL"].IsNull();
+    if (out.hasNormal && (!_accessor(gltf, attributes["NORMAL"].Int(-1), out.normal) ||
+        out.normal.count != out.position.count || out.normal.components != 3))
+        return false;
+
+    out.hasUV = !attributes["TEXCOORD_0"].IsNull();
+    if (out.hasUV && (!_accessor(gltf, attributes["TEXCOORD_0"].Int(-1), out.uv) ||
+        out.uv.count != out.position.count || out.uv.components != 2))
+        return false;
+
+    out.hasIndices = !primitive["indices"].IsNull();
+    if (out.hasIndices && (!_accessor(gltf, primitive["indices"].Int(-1), out.indices) ||
+        out.indices.components != 1 || out.indices.componentType == GLTF_FLOAT ||
+        out.indices.count % 3 != 0))
+        return false;
+
+    if (!out.hasIndices && out.position.count % 3 != 0)
+        return false;
+
+    // Out of range indices would read past the vertex arrays
+    for (size_t i = 0; out.hasIndices && i < out.indices.count; i++)
+        if (out.indices.Index(i) >= out.position.count)
+            return false;
+
+    return true;
+}
+
+Mat4x4 _nodeTransform(const JsonValue& node)
+{
+    const JsonValue& matrix = node["matrix"];
+    if (matrix.Size() == 16)
+    {
+        // glTF matrices are column major
+        return Mat4x4(
+            matrix[0].number, matrix[4].number, matrix[8].number,  matrix[12].number,
+            matrix[1].number, matrix[5].number, matrix[9].number,  matrix[13].number,
+            matrix[2].number, matrix[6].number, matrix[10].number, matrix[14].number,
+            matrix[3].number, matrix[7].number, matrix[11].number, matrix[15].number);
+    }
+
+    const JsonValue& t = node["translation"];
+    const JsonValue& r = node["rotation"];
+    const JsonValue& s = node["scale"];
+    aiVector3f translation(t[0].Number(0.0), t[1].Number(0.0), t[2].Number(0.0));
+    aiQuaterniont<float> rotation(r[3].Number(1.0), r[0].Number(0.0),
+        r[1].Number(0.0), r[2].Number(0.0));
+    aiVector3f scale(s[0].Number(1.0), s[1].Number(1.0), s[2].Number(1.0));
+    return Mat4x4(scale, rotation, translation);
+}
+
+void _buildInstances(const GltfFile& gltf, int nodeIndex, const Mat4x4& parentTF,
+    const std::vector<unsigned int>& firstMesh, SceneHostData& host, int depth)
+{
+    const JsonValue& node = gltf.json["nodes"][nodeIndex];
+    if (node.IsNull() || depth > 64) // malformed files may contain cycles
+        return;
+
+    Mat4x4 currentTF = parentTF * _nodeTransform(node);
+
+    int meshIndex = node["mesh"].Int(-1);
+    if (meshIndex >= 0 && (size_t)meshIndex + 1 < firstMesh.size())
+    {
+        for (unsigned int i = firstMesh[meshIndex]; i < firstMesh[meshIndex + 1]; i++)
+        {
+            SceneInstance inst = {
+                .transform = currentTF,
+                .meshIndex = i,
+                .materialIndex = (unsigned int)host.meshInfoList[i].materialIndex
+            };
+            host.instanceList.push_back(inst);
+        }
+    }
+
+    const JsonValue& children = node["children"];
+    for (size_t i = 0; i < children.Size(); i++)
+        _buildInstances(gltf, children[i].Int(-1), currentTF, firstMesh, host, depth + 1);
+}
+
+// Fills the preallocated ranges of one mesh, safe to run concurrently with other meshes
+void _extractMesh(const GltfPrimitive& primitive, const MeshInfo& meshInfo, SceneHostData& host)
+{
+    size_t vertexCount = primitive.position.count;
+    Vec3* vertices = host.vertexList.data() + meshInfo.vertexOffset / 3;
+    Vec3* normals  = host.normalList.data() + meshInfo.normalOffset / 3;
+    Vec3* uvs      = host.uvList.data()     + meshInfo.uvOffset / 3;
+    Triangle* triangles = host.indexList.data() + meshInfo.indexOffset / 3;
+
+    for (size_t i = 0; i < vertexCount; i++)
+    {
+        vertices[i] = Vec3(primitive.position.Float(i, 0),
+            primitive.position.Float(i, 1), primitive.position.Float(i, 2));
+
+        // Flipped like the Assimp importer does
+        uvs[i] = primitive.hasUV ?
+            Vec3(primitive.uv.Float(i, 0), 1.0f - primitive.uv.Float(i, 1), 0.0f) : Vec3();
+    }
+
+    size_t triangleCount = primitive.hasIndices ? primitive.indices.count / 3 : vertexCount / 3;
+    for (size_t i = 0; i < triangleCount; i++)
+    {
+        if (primitive.hasIndices)
+            triangles[i] = {primitive.indices.Index(i * 3),
+                primitive.indices.Index(i * 3 + 1), primitive.indices.Index(i * 3 + 2)};
+        else
+            triangles[i] = {(unsigned int)(i * 3),
+                (unsigned int)(i * 3 + 1), (unsigned int)(i * 3 + 2)};
+    }
+
+    if (primitive.hasNormal)
+    {
+        for (size_t i = 0; i < vertexCount; i++)
+            normals[i] = Vec3(primitive.normal.Float(i, 0),
+                primitive.normal.Float(i, 1), primitive.normal.Float(i, 2));
+        return;
+    }
+
+    // Smooth normals, area weighted face normals summed per vertex
+    for (size_t i = 0; i < vertexCount; i++)
+        normals[i] = Vec3();
+
+    for (size_t i = 0; i < triangleCount; i++)
+    {
+        const Triangle& t = triangles[i];
+        Vec3 e1 = vertices[t.idx1] - vertices[t.idx0];
+        Vec3 e2 = vertices[t.idx2] - vertices[t.idx0];
+        Vec3 n(e1.y * e2.z - e1.z * e2.y, e1.z * e2.x - e1.x * e2.z, e1.x * e2.y - e1.y * e2.x);
+        normals[t.idx0] += n;
+        normals[t.idx1] += n;
+        normals[t.idx2] += n;
+    }
+
+    for (size_t i = 0; i < vertexCount; i++)
+    {
+        if (normals[i].Length() > 0.0f)
+            normals[i].Normalize();
+    }
+}
+
+bool _importGLB(const GltfFile& gltf, SceneHostData& host)
+{
+    const JsonValue& json = gltf.json;
+
+    // Validate everything up front, the parallel passes below cannot fail
+    std::vector<GltfPrimitive> primitives;
+    std::vector<unsigned int> firstMesh;
+    const JsonValue& meshes = json["meshes"];
+    for (size_t m = 0; m < meshes.Size(); m++)
+    {
+        firstMesh.push_back(primitives.size());
+        const JsonValue& meshPrimitives = meshes[m]["primitives"];
+        for (size_t p = 0; p < meshPrimitives.Size(); p++)
+        {
+            GltfPrimitive primitive;
+            if (!_primitive(gltf, meshPrimitives[p], primitive))
+                return false;
+            primitives.push_back(primitive);
+        }
+    }
+    firstMesh.push_back(primitives.size());
+
+    const JsonValue& materials = json["materials"];
+    for (size_t i = 0; i < materials.Size(); i++)
+        host.matList.push_back(_material(gltf, materials[i]));
+
+    // Primitives without a material get the glTF default one, appended last
+    int defaultMaterial = -1;
+    size_t vertexCount = 0, triangleCount = 0;
+    for (size_t m = 0; m < meshes.Size(); m++)
+    {
+        const JsonValue& meshPrimitives = meshes[m]["primitives"];
+        for (size_t p = 0; p < meshPrimitives.Size(); p++)
+        {
+            const GltfPrimitive& primitive = primitives[firstMesh[m] + p];
+            int materialIndex = meshPrimitives[p]["material"].Int(-1);
+            if (materialIndex < 0 || (size_t)materialIndex >= materials.Size())
+            {
+                if (defaultMaterial < 0)
+                {
+                    defaultMaterial = host.matList.size();
+                    host.matList.push_back(_material(gltf, JsonValue()));
+                }
+                materialIndex = defaultMaterial;
+            }
+
+            // Scalar offsets into the host arrays, 3 floats per vertex and 3 indices per
+            // triangle. PackAttributes() turns the attribute ones into packed stream offsets.
+            MeshInfo meshInfo = {
+                .vertexOffset  = (int)(vertexCount * 3),
+                .indexOffset   = (int)(triangleCount * 3),
+                .uvOffset      = (int)(vertexCount * 3),
+                .normalOffset  = (int)(vertexCount * 3),
+                .materialIndex = materialIndex,
+                .indexFormat   = ATTRIBUTE_INDEX_UINT32, // set by PackAttributes()
+                .uvFormat      = ATTRIBUTE_UV_FLOAT2,
+                .normalFormat  = ATTRIBUTE_NORMAL_FLOAT3
+            };
+
+            size_t meshTriangles = primitive.hasIndices ?
+                primitive.indices.count / 3 : primitive.position.count / 3;
+            host.meshInfoList.push_back(meshInfo);
+            host.meshVertexCount.push_back(primitive.position.count);
+            host.meshTriangleCount.push_back(meshTriangles);
+
+            vertexCount += primitive.position.count;
+            triangleCount += meshTriangles;
+        }
+    }
+
+    // Images must live in the binary chunk to be decoded here
+    const JsonValue& images = json["images"];
+    std::vector<std::pair<const unsigned char*, size_t>> encoded(images.Size());
+    for (size_t i = 0; i < images.Size(); i++)
+    {
+        encoded[i].first = _bufferView(gltf,
+            images[i]["bufferView"].Int(-1), &encoded[i].second, nullptr);
+        if (encoded[i].first == nullptr)
+            return false;
+    }
+
+    host.vertexList.resize(vertexCount);
+    host.normalList.resize(vertexCount);
+    host.uvList.resize(vertexCount);
+    host.indexList.resize(triangleCount);
+
+    ThreadPool::Get()->ParallelFor(primitives.size(), [&](size_t i) {
+        _extractMesh(primitives[i], host.meshInfoList[i], host);
+    });
+
+    std::vector<TextureLevels> textures(encoded.size());
+    std::atomic<bool> decoded(true);
+    ThreadPool::Get()->ParallelFor(encoded.size(), [&](size_t i) {
+        if (!DecodeTexture(encoded[i].first, encoded[i].second, textures[i]))
+            decoded = false;
+    });
+    if (!decoded)
+        return false;
+    _textureSamplers(gltf, textures);
+    if (!AppendTextures(host, textures))
+        return false;
+
+    const JsonValue& scene = json["scenes"][json["scene"].Int(0)];
+    const JsonValue& roots = scene["nodes"];
+    for (size_t i = 0; i < roots.Size(); i++)
+        _buildInstances(gltf, roots[i].Int(-1), Mat4x4{}, firstMesh, host, 0);
+
+    for (const Material& material: host.matList)
+    {
+        host.hasTextures |= material.albedoTexIdx != -1 || material.metallicTexIdx != -1 ||
+            material.roughnessTexIdx != -1 || material.normalTexIdx != -1;
+        host.hasTransmission |= material.transmission > 0.0f;
+    }
+
+    return true;
+}
+
+bool ImportGLB(const std::string& path, SceneHostData& host)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < 20)
+    {
+        close(fd);
+        return false;
+    }
+
+    void* mapping = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED)
+        return false;
+
+    const unsigned char* base = (const unsigned char*) mapping;
+    size_t size = st.st_size;
+
+    // 12 byte header, then chunks of {length, type, data} padded to 4 bytes
+    uint32_t header[3];
+    memcpy(header, base, sizeof(header));
+
+    GltfFile gltf;
+    bool valid = header[0] == GLB_MAGIC && header[1] == 2 && header[2] <= size;
+    const unsigned char* jsonChunk = nullptr;
+    size_t jsonSize = 0;
+
+    for (size_t offset = 12; valid && offset + 8 <= header[2];)
+    {
+        uint32_t chunk[2];
+        memcpy(chunk, base + offset, sizeof(chunk));
+        offset += 8;
+        if (chunk[0] > header[2] - offset)
+        {
+            valid = false;
+            break;
+        }
+
+        if (chunk[1] == GLB_CHUNK_JSON && jsonChunk == nullptr)
+        {
+            jsonChunk = base + offset;
+            jsonSize = chunk[0];
+        }
+        else if (chunk[1] == GLB_CHUNK_BIN && gltf.bin == nullptr)
+        {
+            gltf.bin = base + offset;
+            gltf.binSize = chunk[0];
+        }
+        offset += (chunk[0] + 3) & ~3u;
+    }
+
+    if (valid && jsonChunk)
+    {
+        JsonParser parser = {(const char*) jsonChunk, (const char*) jsonChunk + jsonSize};
+        valid = parser.ParseValue(gltf.json) && gltf.json.type == JsonValue::JSON_OBJECT &&
+            _importGLB(gltf, host);
+    }
+    else
+    {
+        valid = false;
+    }
+
+    munmap(mapping, st.st_size);
+    return valid;
+}
+
+} // namespace RD
@@ -0,0 +1,14 @@
+#pragma once
+
+#include "sceneBuilder.h"
+
+namespace RD
+{
+
+// Native glTF 2.0 binary (.glb) import. The file is memory-mapped and accessors are
+// read straight from the binary chunk, meshes are converted in parallel.
+// Returns false for features outside the fast path (external buffers or images,
+// sparse accessors, non-triangle primitives), the caller falls back to Assimp.
+bool ImportGLB(const std::string& path, SceneHostData& host);
+
+} // namespace RD
@@ -1,4 +1,7 @@
 #include "sceneBuilder.h"
+#include "cookedScene.h"
+#include "gltfLoader.h"
+#include "threadPool.h"
 
 #include <assimp/Importer.hpp>      // C++ importer interface
 #include <assimp/scene.h>           // Output data structure
@@ -7,24 +10,82 @@
 
 #include <iostream>
 #include <cassert>
+#include <cstring>
+#include <algorithm>
+#include <type_traits>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
-#define STB_IMAGE_RESIZE_IMPLEMENTATION
-#include "stb_image_resize2.h"
-
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stb_image_write.h"
 
 
-#define TEX_DIM 4096 // Fixed dimension of textures in texture array for materials.
-
-
 namespace RD
 {
 
 Scene* Scene::Load(std::string path, RD::Platform* plt, bool loadFromCache)
+{
+    SceneHostData host;
+    host.textureLayout = RD::PreferredTextureLayout(plt);
+    if (!Import(path, host))
+        return nullptr;
+
+    // The whole-scene cache is only trusted when it is newer than the model,
+    // rebuilding is cheap otherwise since unchanged meshes come from the BLAS cache
+    std::string cachePath = path + ".cache";
+    struct stat modelStat, cacheStat;
+    bool cacheValid = stat(path.c_str(), &modelStat) == 0 &&
+        stat(cachePath.c_str(), &cacheStat) == 0 &&
+        cacheStat.st_mtime >= modelStat.st_mtime;
+
+    if (loadFromCache && cacheValid)
+    {
+        RD::Scene* rdScene = Upload(host, plt);
+        if (RD::FileToTopAccelStruct(plt, cachePath.c_str(), &rdScene->topAccelStruct))
+            return rdScene;
+
+        rdScene->topAccelStruct = BuildAccelStruct(host, plt);
+        RD::TopAccelStructToFile(plt, rdScene->topAccelStruct, cachePath.c_str());
+        return rdScene;
+    }
+
+    // Bottom level AS build on the pool while the scene buffers stream to the device
+    std::vector<std::future<RD::BottomAccelStruct>> bottomAccelStructs =
+        BuildBottomAccelStructs(host, plt);
+    RD::Scene* rdScene = Upload(host, plt);
+
+    rdScene->topAccelStruct = BuildTopAccelStruct(host, plt, bottomAccelStructs);
+    RD::TopAccelStructToFile(plt, rdScene->topAccelStruct, cachePath.c_str());
+    return rdScene;
+}
+
+bool Scene::Import(std::string path, SceneHostData& host)
+{
+    std::string extension = path.substr(std::min(path.size(), path.rfind('.')));
+    std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+
+    if (extension == ".glb")
+    {
+        if (ImportGLB(path, host))
+            return true;
+
+        printf("Native glTF import of %s failed, falling back to Assimp\n", path.c_str());
+        SceneHostData settings;
+        settings.textureLayout = host.textureLayout;
+        settings.leafOrder = host.leafOrder;
+        host = settings;
+    }
+
+    return ImportAssimp(path, host);
+}
+
+bool Scene::ImportAssimp(std::string path, SceneHostData& host)
 {
     // Create an instance of the Importer class
     Assimp::Importer importer;
@@ -35,70 +96,86 @@ Scene* Scene::Load(std::string path, RD::Platform* plt, bool loadFromCache)
         aiProcess_JoinIdenticalVertices  |
         aiProcess_SortByPType);
 
-    assert(scene != nullptr);
-    RD::ImageArray rdTextureData = RD::CreateImageArray(plt, TEX_DIM, TEX_DIM, scene->mNumTextures);
-    RD::Sampler rdSampler = RD::CreateSampler(plt, RD_ADDRESS_REPEAT, RD_FILTER_LINEAR);
-
-    std::vector<RD::MeshInfo>   meshInfoList;
-    std::vector<RD::Vec3>       vertexList;
-    std::vector<RD::Triangle>   indexList;
-    std::vector<RD::Vec3>       uvList;
-    std::vector<RD::Vec3>       normalList;
-    std::vector<RD::Material>   matList;
-
-    for (int i = 0; i < scene->mNumTextures; i++)
+    if (scene == nullptr)
     {
-        const aiTexture* tex = scene->mTextures[i];
-        assert(tex->mHeight == 0); // Compressed image
-
-        int x, y, ch;
-        unsigned char* data = stbi_load_from_memory(
-            (const unsigned char*)tex->pcData,
-            tex->mWidth, &x, &y, &ch, RD_CHANNEL
-        );
-
-        unsigned char* texture = stbir_resize_uint8_linear(
-            data, x, y, 0, NULL, TEX_DIM, TEX_DIM, 0, STBIR_RGBA
-        );
-
-        RD::WriteImage(plt, rdTextureData, TEX_DIM, TEX_DIM, i, texture);
-        free(data);
-        stbi_image_free(texture);
+        printf("Failed to import scene %s: %s\n", path.c_str(), importer.GetErrorString());
+        return false;
     }
 
+    // Textures decode in parallel with each other and with the mesh extraction below
+    std::vector<TextureLevels> decoded(scene->mNumTextures);
+    std::future<void> textures = ThreadPool::Get()->Submit([&]() {
+        ThreadPool::Get()->ParallelFor(scene->mNumTextures, [&](size_t i) {
+            const aiTexture* tex = scene->mTextures[i];
+            assert(tex->mHeight == 0); // Compressed image
+
+            if (!DecodeTexture((const unsigned char*)tex->pcData, tex->mWidth, decoded[i]))
+            {
+                // Keep the index valid for the materials referencing it
+                printf("Failed to decode texture %lu: %s\n", i, stbi_failure_reason());
+                const unsigned char white[RD_CHANNEL] = {255, 255, 255, 255};
+                decoded[i].width = decoded[i].height = 1;
+                decoded[i].levels.assign(white, white + RD_CHANNEL);
+            }
+        });
+    });
+
+    // Ranges are laid out first, so every mesh is copied once, in parallel
+    size_t vertexCount = 0, triangleCount = 0;
     for (int i = 0; i < scene->mNumMeshes; i++)
     {
         const aiMesh* mesh = scene->mMeshes[i];
 
         RD::MeshInfo meshInfo = { //FIXME: element offset
-            .vertexOffset  = (int)(vertexList.size() * 3),// sizeof(RD::Vec3)),
-            .indexOffset   = (int)(indexList.size()  * 3),// sizeof(RD::Triangle)),
-            .uvOffset      = (int)(uvList.size()     * 3),// sizeof(RD::Vec3)),
-            .normalOffset  = (int)(normalList.size() * 3),// sizeof(RD::Vec3)),
-            .materialIndex = (int)(mesh->mMaterialIndex)
+            .vertexOffset  = (int)(vertexCount * 3),// sizeof(RD::Vec3)),
+            .indexOffset   = (int)(triangleCount * 3),// sizeof(RD::Triangle)),
+            .uvOffset      = (int)(vertexCount * 3),// sizeof(RD::Vec3)),
+            .normalOffset  = (int)(vertexCount * 3),// sizeof(RD::Vec3)),
+            .materialIndex = (int)(mesh->mMaterialIndex),
+            .indexFormat   = ATTRIBUTE_INDEX_UINT32, // set by PackAttributes()
+            .uvFormat      = ATTRIBUTE_UV_FLOAT2,
+            .normalFormat  = ATTRIBUTE_NORMAL_FLOAT3
         };
 
+        host.meshInfoList.push_back(meshInfo);
+        host.meshVertexCount.push_back(mesh->mNumVertices);
+        host.meshTriangleCount.push_back(mesh->mNumFaces);
+        vertexCount += mesh->mNumVertices;
+        triangleCount += mesh->mNumFaces;
+    }
+
+    host.vertexList.resize(vertexCount);
+    host.normalList.resize(vertexCount);
+    host.uvList.resize(vertexCount);
+    host.indexList.resize(triangleCount);
+
+    ThreadPool::Get()->ParallelFor(scene->mNumMeshes, [&](size_t m) {
+        const aiMesh* mesh = scene->mMeshes[m];
+        const RD::MeshInfo& meshInfo = host.meshInfoList[m];
+        RD::Vec3* vertices = host.vertexList.data() + meshInfo.vertexOffset / 3;
+        RD::Vec3* normals = host.normalList.data() + meshInfo.normalOffset / 3;
+        RD::Vec3* uvs = host.uvList.data() + meshInfo.uvOffset / 3;
+        RD::Triangle* triangles = host.indexList.data() + meshInfo.indexOffset / 3;
+
         for (size_t i = 0; i < mesh->mNumVertices; i++)
         {
-            vertexList.push_back(mesh->mVertices[i]);
-            normalList.push_back(mesh->mNormals[i]);
-            uvList.push_back(mesh->mTextureCoords[0]?
-                mesh->mTextureCoords[0][i]: aiVector3D());
+            vertices[i] = mesh->mVertices[i];
+            normals[i] = mesh->mNormals[i];
+            uvs[i] = mesh->mTextureCoords[0]?
+                mesh->mTextureCoords[0][i]: aiVector3D();
         }
 
         for (size_t i = 0; i < mesh->mNumFaces; i++)
         {
             assert(mesh->mFaces[i].mNumIndices == 3);
 
-            indexList.push_back({
+            triangles[i] = {
                 mesh->mFaces[i].mIndices[0],
                 mesh->mFaces[i].mIndices[1],
                 mesh->mFaces[i].mIndices[2]
-            });
+            };
         }
-
-        meshInfoList.push_back(meshInfo);
-    }
+    });
 
     for (int i = 0; i < scene->mNumMaterials; i++)
     {
@@ -191,85 +268,249 @@ Scene* Scene::Load(std::string path, RD::Platform* plt, bool loadFromCache)
             }
         }
 
-        matList.push_back(material);
+        host.matList.push_back(material);
     }
-    
-    unsigned int meshInfoSize = meshInfoList.size() * sizeof(RD::MeshInfo);
-    RD::Buffer rdMeshInfoData = RD::CreateBuffer(plt, meshInfoSize);
-    RD::WriteBuffer(plt, rdMeshInfoData, meshInfoSize, meshInfoList.data());
-
-    unsigned int vertexSize = vertexList.size() * sizeof(RD::Vec3);
-    RD::Buffer rdVertexData = RD::CreateBuffer(plt, vertexSize);
-    RD::WriteBuffer(plt, rdVertexData, vertexSize, vertexList.data());
 
-    unsigned int indexSize = indexList.size() * sizeof(RD::Triangle);
-    RD::Buffer rdIndexData = RD::CreateBuffer(plt, indexSize);
-    RD::WriteBuffer(plt, rdIndexData, indexSize, indexList.data());
+    // Material features used by the scene, for shader specialization
+    for (const RD::Material& material: host.matList)
+    {
+        host.hasTextures |= material.albedoTexIdx != -1 || material.metallicTexIdx != -1 ||
+            material.roughnessTexIdx != -1 || material.normalTexIdx != -1;
+        host.hasTransmission |= material.transmission > 0.0f;
+    }
+    
+    BuildInstance(scene->mRootNode, host.instanceList, RD::Mat4x4{}, scene);
 
-    unsigned int uvSize = uvList.size() * sizeof(RD::Vec3);
-    RD::Buffer rdUVData = RD::CreateBuffer(plt, uvSize);
-    RD::WriteBuffer(plt, rdUVData, uvSize, uvList.data());
+    // The importer owns the compressed texture data
+    textures.get();
+    return AppendTextures(host, decoded);
+}
 
-    unsigned int normalSize = normalList.size() * sizeof(RD::Vec3);
-    RD::Buffer rdNormalData = RD::CreateBuffer(plt, normalSize);
-    RD::WriteBuffer(plt, rdNormalData, normalSize, normalList.data());
+bool DecodeTexture(const unsigned char* encoded, size_t size, TextureLevels& texture)
+{
+    int x, y, ch;
+    unsigned char* data = stbi_load_from_memory(encoded, size, &x, &y, &ch, RD_CHANNEL);
+    if (data == nullptr)
+        return false;
+
+    texture.width = x;
+    texture.height = y;
+    RD::BuildMipChain(x, y, data, texture.levels);
+    stbi_image_free(data);
+    return true;
+}
 
-    unsigned int matSize = matList.size() * sizeof(RD::Material);
-    RD::Buffer rdMatData = RD::CreateBuffer(plt, matSize);
-    RD::WriteBuffer(plt, rdMatData, matSize, matList.data());
+enum TextureUsage
+{
+    TEXTURE_USAGE_ALBEDO    = 1 << 0,
+    TEXTURE_USAGE_NORMAL    = 1 << 1,
+    TEXTURE_USAGE_METALLIC  = 1 << 2, // read from z
+    TEXTURE_USAGE_ROUGHNESS = 1 << 3  // read from y
+};
+
+// Leaves format and swizzle untouched (RGBA8) when compression does not apply
+void _textureFormat(unsigned int usage, unsigned int* format, unsigned int* swizzle)
+{
+    const unsigned int metallicRoughness = TEXTURE_USAGE_METALLIC | TEXTURE_USAGE_ROUGHNESS;
 
+    if (!COMPRESS_TEXTURES || usage == 0)
+        return;
 
-    RD::TopAccelStruct rdTopAS;
-    if (loadFromCache)
+    if (usage == TEXTURE_USAGE_ALBEDO)
     {
-        std::string cachePath = path + ".cache";
-        RD::FileToTopAccelStruct(plt, cachePath.c_str(), &rdTopAS);
+        *format = TEXTURE_FORMAT_BC1;
     }
-    else
+    else if (usage == TEXTURE_USAGE_NORMAL)
+    {
+        *format = TEXTURE_FORMAT_BC5;
+        *swizzle = TEXTURE_SWIZZLE(TEXTURE_CHANNEL_R, TEXTURE_CHANNEL_G,
+            TEXTURE_CHANNEL_NORMAL_Z, TEXTURE_CHANNEL_ONE);
+    }
+    else if (usage == metallicRoughness)
+    {
+        *format = TEXTURE_FORMAT_BC5;
+        *swizzle = TEXTURE_SWIZZLE(TEXTURE_CHANNEL_ZERO, TEXTURE_CHANNEL_R,
+            TEXTURE_CHANNEL_G, TEXTURE_CHANNEL_ONE);
+    }
+    else if (usage == TEXTURE_USAGE_ROUGHNESS)
     {
-        time_t start_t, end_t;
-        double diff_t;
-        time(&start_t);
-        int totalTriangles = 0, totalVertices = 0;
+        *format = TEXTURE_FORMAT_BC4;
+        *swizzle = TEXTURE_SWIZZLE(TEXTURE_CHANNEL_ZERO, TEXTURE_CHANNEL_R,
+            TEXTURE_CHANNEL_ZERO, TEXTURE_CHANNEL_ONE);
+    }
+    else if (usage == TEXTURE_USAGE_METALLIC)
+    {
+        *format = TEXTURE_FORMAT_BC4;
+        *swizzle = TEXTURE_SWIZZLE(TEXTURE_CHANNEL_ZERO, TEXTURE_CHANNEL_ZERO,
+            TEXTURE_CHANNEL_R, TEXTURE_CHANNEL_ONE);
+    }
+    // Mixed usage keeps every channel
+}
 
-        std::vector<RD::BottomAccelStruct> rdBotASList;
-        for (int i = 0; i < scene->mNumMeshes; i++)
-        {
-            const aiMesh* mesh = scene->mMeshes[i];
-            RD::Mesh rdMesh;
+bool AppendTextures(SceneHostData& host, const std::vector<TextureLevels>& textures)
+{
+    std::vector<unsigned int> usage(textures.size(), 0);
+    auto use = [&](int texIdx, unsigned int flag) {
+        if (texIdx >= 0 && texIdx < (int)usage.size())
+            usage[texIdx] |= flag;
+    };
+    for (const RD::Material& material: host.matList)
+    {
+        use(material.albedoTexIdx, TEXTURE_USAGE_ALBEDO);
+        use(material.normalTexIdx, TEXTURE_USAGE_NORMAL);
+        use(material.metallicTexIdx, TEXTURE_USAGE_METALLIC);
+        use(material.roughnessTexIdx, TEXTURE_USAGE_ROUGHNESS);
+    }
 
-            totalTriangles += mesh->mNumFaces;
-            totalVertices += mesh->mNumVertices;
+    // Block encoding is the slow part, textures are encoded on the pool and packed in order
+    std::vector<std::vector<RD::TextureInfo>> infos(textures.size());
+    std::vector<std::vector<unsigned char>> encoded(textures.size());
+    ThreadPool::Get()->ParallelFor(textures.size(), [&](size_t i) {
+        RD::TextureDesc desc;
+        desc.layout = host.textureLayout;
+        desc.addressMode = textures[i].addressMode;
+        desc.filterMode = textures[i].filterMode;
+        _textureFormat(usage[i], &desc.format, &desc.swizzle);
+        RD::AppendTexture(infos[i], encoded[i], textures[i].width, textures[i].height,
+            textures[i].levels, desc);
+    });
+
+    size_t rawSize = 0;
+    for (size_t i = 0; i < textures.size(); i++)
+    {
+        // Offsets are relative to the texture, rebase them on the shared buffer
+        size_t base = (host.textureData.size() + TEXTURE_ALIGNMENT - 1) &
+            ~(size_t)(TEXTURE_ALIGNMENT - 1);
+        if (base + encoded[i].size() > UINT32_MAX)
+        {
+            printf("Texture table passes 4 GB at texture %lu, texel offsets are 32-bit\n", i);
+            return false;
+        }
+        host.textureData.resize(base);
+        host.textureData.insert(host.textureData.end(), encoded[i].begin(), encoded[i].end());
+
+        RD::TextureInfo info = infos[i][0];
+        for (unsigned int level = 0; level < info.levelCount; level++)
+            info.levelOffset[level] += base;
+        host.textureInfoList.push_back(info);
+        rawSize += textures[i].levels.size();
+    }
 
-            for (size_t i = 0; i < mesh->mNumVertices; i++)
-                rdMesh.vertexData.push_back(mesh->mVertices[i]);
+    if (!textures.empty())
+        printf("Textures: %lu, %.1f MB with mips (%.1f MB uncompressed)\n", textures.size(),
+            host.textureData.size() / (1024.0 * 1024.0), rawSize / (1024.0 * 1024.0));
+    return true;
+}
 
-            for (size_t i = 0; i < mesh->mNumFaces; i++)
-                rdMesh.indexData.push_back({
-                    mesh->mFaces[i].mIndices[0],
-                    mesh->mFaces[i].mIndices[1],
-                    mesh->mFaces[i].mIndices[2]
-                });
+void PackAttributes(const SceneHostData& host, std::vector<RD::MeshInfo>& meshInfoList,
+    RD::AttributeStreams& streams)
+{
+    auto textureSize = [&](int texIdx) {
+        if (texIdx < 0 || texIdx >= (int)host.textureInfoList.size())
+            return 0u;
+        const RD::TextureInfo& info = host.textureInfoList[texIdx];
+        return std::max(info.width, info.height);
+    };
+
+    // Meshes pack on the pool, the streams are joined in order
+    meshInfoList = host.meshInfoList;
+    std::vector<RD::AttributeStreams> packed(meshInfoList.size());
+    ThreadPool::Get()->ParallelFor(meshInfoList.size(), [&](size_t i) {
+        RD::MeshInfo& meshInfo = meshInfoList[i];
+        RD::MeshView mesh = {
+            .vertexData  = host.vertexList.data() + meshInfo.vertexOffset / 3,
+            .vertexCount = host.meshVertexCount[i],
+            .indexData   = host.indexList.data() + meshInfo.indexOffset / 3,
+            .indexCount  = host.meshTriangleCount[i]
+        };
 
-            rdBotASList.push_back(RD::BuildAccelStruct(plt, rdMesh));
+        unsigned int maxSize = 0;
+        if (meshInfo.materialIndex >= 0 && meshInfo.materialIndex < (int)host.matList.size())
+        {
+            const RD::Material& material = host.matList[meshInfo.materialIndex];
+            maxSize = std::max({textureSize(material.albedoTexIdx), textureSize(material.normalTexIdx),
+                textureSize(material.metallicTexIdx), textureSize(material.roughnessTexIdx)});
         }
 
-        std::vector<RD::Instance> rdInstanceList;
-        BuildInstance(scene->mRootNode, rdInstanceList, RD::Mat4x4{}, scene, rdBotASList);
-        
-        rdTopAS = RD::BuildAccelStruct(plt, rdInstanceList);
-        std::string cachePath = path + ".cache";
-        RD::TopAccelStructToFile(plt, rdTopAS, cachePath.c_str());
-
-        time(&end_t);
-        diff_t = difftime(end_t, start_t);
-        printf("\nBVH build report:\n");
-        printf("\tNumber of meshes: %d\n", scene->mNumMeshes);
-        printf("\tNumber of vertices: %d\n", totalVertices);
-        printf("\tNumber of triangles: %d\n", totalTriangles);
-        printf("\tBuild time cost: %f (sec)\n", diff_t);
+        RD::AttributeDesc desc;
+        if (maxSize > 0)
+            desc.uvTolerance = 0.5f / maxSize;
+        RD::AppendMeshAttributes(packed[i], meshInfo, mesh,
+            host.uvList.data() + meshInfo.uvOffset / 3,
+            host.normalList.data() + meshInfo.normalOffset / 3, desc);
+    });
+
+    auto join = [](std::vector<uint32_t>& stream, const std::vector<uint32_t>& mesh) {
+        int base = stream.size();
+        stream.insert(stream.end(), mesh.begin(), mesh.end());
+        return base;
+    };
+    for (size_t i = 0; i < meshInfoList.size(); i++)
+    {
+        meshInfoList[i].indexOffset  += join(streams.indexData, packed[i].indexData);
+        meshInfoList[i].uvOffset     += join(streams.uvData, packed[i].uvData);
+        meshInfoList[i].normalOffset += join(streams.normalData, packed[i].normalData);
     }
 
+    size_t floatSize = (host.indexList.size() * 3 + host.uvList.size() * 3 +
+        host.normalList.size() * 3) * sizeof(float);
+    size_t packedSize = (streams.indexData.size() + streams.uvData.size() +
+        streams.normalData.size()) * sizeof(uint32_t);
+    printf("Attributes: %.1f MB packed (%.1f MB unpacked)\n",
+        packedSize / (1024.0 * 1024.0), floatSize / (1024.0 * 1024.0));
+}
+
+Scene* Scene::Upload(const SceneHostData& host, RD::Platform* plt)
+{
+    RD::UploadManager uploader = RD::CreateUploadManager(plt);
+
+    // Host visible allocations make the uploads below in-place writes on unified memory
+    RD::MemoryFlags memFlags = RD::HasUnifiedMemory(plt) ? RD_MEMORY_HOST_ALLOC : RD_MEMORY_DEVICE;
+
+    std::vector<RD::MeshInfo> meshInfoList;
+    RD::AttributeStreams attributes;
+    PackAttributes(host, meshInfoList, attributes);
+
+    unsigned int meshInfoSize = meshInfoList.size() * sizeof(RD::MeshInfo);
+    RD::Buffer rdMeshInfoData = RD::CreateBuffer(plt, meshInfoSize, memFlags);
+    RD::UploadBuffer(uploader, rdMeshInfoData, meshInfoSize, meshInfoList.data());
+
+    size_t vertexSize = host.vertexList.size() * sizeof(RD::Vec3);
+    RD::Buffer rdVertexData = RD::CreateBuffer(plt, vertexSize, memFlags);
+    RD::UploadBuffer(uploader, rdVertexData, vertexSize, host.vertexList.data());
+
+    size_t indexSize = attributes.indexData.size() * sizeof(uint32_t);
+    RD::Buffer rdIndexData = RD::CreateBuffer(plt, indexSize, memFlags);
+    RD::UploadBuffer(uploader, rdIndexData, indexSize, attributes.indexData.data());
+
+    size_t uvSize = attributes.uvData.size() * sizeof(uint32_t);
+    RD::Buffer rdUVData = RD::CreateBuffer(plt, uvSize, memFlags);
+    RD::UploadBuffer(uploader, rdUVData, uvSize, attributes.uvData.data());
+
+    size_t normalSize = attributes.normalData.size() * sizeof(uint32_t);
+    RD::Buffer rdNormalData = RD::CreateBuffer(plt, normalSize, memFlags);
+    RD::UploadBuffer(uploader, rdNormalData, normalSize, attributes.normalData.data());
+
+    size_t matSize = host.matList.size() * sizeof(RD::Material);
+    RD::Buffer rdMatData = RD::CreateBuffer(plt, matSize, memFlags);
+    RD::UploadBuffer(uploader, rdMatData, matSize, host.matList.data());
+
+    // Scenes without textures still bind valid buffers
+    size_t textureInfoSize = host.textureInfoList.size() * sizeof(RD::TextureInfo);
+    RD::Buffer rdTextureInfoData = RD::CreateBuffer(plt,
+        std::max(textureInfoSize, sizeof(RD::TextureInfo)), memFlags);
+    if (textureInfoSize > 0)
+        RD::UploadBuffer(uploader, rdTextureInfoData, textureInfoSize, host.textureInfoList.data());
+
+    size_t textureSize = host.textureData.size();
+    RD::Buffer rdTextureData = RD::CreateBuffer(plt,
+        std::max(textureSize, (size_t)RD_CHANNEL), memFlags);
+    if (textureSize > 0)
+        RD::UploadBuffer(uploader, rdTextureData, textureSize, host.textureData.data());
+
+    // Sync point: waits for all staged scene uploads
+    RD::DestroyUploadManager(uploader);
+
     RD::Scene* rdScene = new RD::Scene();
     rdScene->meshInfoData   = rdMeshInfoData;
     rdScene->vertexData     = rdVertexData;
@@ -277,16 +518,345 @@ Scene* Scene::Load(std::string path, RD::Platform* plt, bool loadFromCache)
     rdScene->uvData         = rdUVData;
     rdScene->normalData     = rdNormalData;
     rdScene->materialData   = rdMatData;
+    rdScene->textureInfoData = rdTextureInfoData;
     rdScene->textureData    = rdTextureData;
-    rdScene->sampler        = rdSampler;
-    rdScene->topAccelStruct = rdTopAS;
+    rdScene->texturePageTable = RD::CreateBuffer(plt, sizeof(uint32_t));
+    rdScene->textureFeedback = RD::CreateBuffer(plt, sizeof(uint32_t));
+    rdScene->topAccelStruct = nullptr;
+    rdScene->hasTextures    = host.hasTextures;
+    rdScene->hasTransmission = host.hasTransmission;
+
+    return rdScene;
+}
+
+// Permutes the host ranges of a mesh to the order of its bottom level AS
+void _reorderMesh(SceneHostData& host, size_t meshIndex, RD::BottomAccelStruct accelStruct)
+{
+    const RD::MeshInfo& meshInfo = host.meshInfoList[meshIndex];
+    std::vector<unsigned int> faceOrder, vertexOrder;
+    RD::ReorderAccelStructMesh(accelStruct, host.meshVertexCount[meshIndex], faceOrder, vertexOrder);
+
+    std::vector<unsigned int> remap(vertexOrder.size());
+    for (unsigned int i = 0; i < vertexOrder.size(); i++)
+        remap[vertexOrder[i]] = i;
+
+    auto permute = [](auto* data, const std::vector<unsigned int>& order) {
+        std::vector<std::remove_reference_t<decltype(*data)>> original(data, data + order.size());
+        for (size_t i = 0; i < order.size(); i++)
+            data[i] = original[order[i]];
+    };
+
+    RD::Triangle* triangles = host.indexList.data() + meshInfo.indexOffset / 3;
+    permute(triangles, faceOrder);
+    for (size_t i = 0; i < faceOrder.size(); i++)
+        triangles[i] = {remap[triangles[i].idx0], remap[triangles[i].idx1], remap[triangles[i].idx2]};
+
+    permute(host.vertexList.data() + meshInfo.vertexOffset / 3, vertexOrder);
+    permute(host.uvList.data() + meshInfo.uvOffset / 3, vertexOrder);
+    permute(host.normalList.data() + meshInfo.normalOffset / 3, vertexOrder);
+}
+
+std::vector<std::future<RD::BottomAccelStruct>> Scene::BuildBottomAccelStructs(
+    SceneHostData& host, RD::Platform* plt)
+{
+    // Largest meshes first, so one big mesh does not end up last on a busy pool
+    std::vector<size_t> order(host.meshInfoList.size());
+    for (size_t i = 0; i < order.size(); i++)
+        order[i] = i;
+    std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        return host.meshTriangleCount[a] > host.meshTriangleCount[b];
+    });
+
+    std::vector<std::future<RD::BottomAccelStruct>> bottomAccelStructs(order.size());
+    for (size_t i: order)
+    {
+        // Traversal reads the positions from the scene vertex buffer the shaders use
+        const RD::MeshInfo& meshInfo = host.meshInfoList[i];
+        RD::MeshView mesh = {
+            .vertexData  = host.vertexList.data() + meshInfo.vertexOffset / 3,
+            .vertexCount = host.meshVertexCount[i],
+            .indexData   = host.indexList.data() + meshInfo.indexOffset / 3,
+            .indexCount  = host.meshTriangleCount[i],
+            .vertexBufferOffset = (unsigned int)meshInfo.vertexOffset,
+            .vertexBufferStride = 3
+        };
+
+        bottomAccelStructs[i] = ThreadPool::Get()->Submit([plt, mesh, &host, i]() {
+            RD::BottomAccelStruct accelStruct = RD::BuildAccelStruct(plt, mesh);
+            if (host.leafOrder)
+                _reorderMesh(host, i, accelStruct);
+            return accelStruct;
+        });
+    }
+    return bottomAccelStructs;
+}
+
+RD::TopAccelStruct Scene::BuildTopAccelStruct(const SceneHostData& host, RD::Platform* plt,
+    std::vector<std::future<RD::BottomAccelStruct>>& bottomAccelStructs)
+{
+    time_t start_t, end_t;
+    double diff_t;
+    time(&start_t);
+
+    std::vector<RD::BottomAccelStruct> rdBotASList;
+    for (std::future<RD::BottomAccelStruct>& bottomAccelStruct: bottomAccelStructs)
+        rdBotASList.push_back(bottomAccelStruct.get());
+
+    std::vector<RD::Instance> rdInstanceList;
+    for (const SceneInstance& instance: host.instanceList)
+    {
+        RD::Instance inst = {
+            .transform = instance.transform,
+            .SBTOffset = 0,
+            .customInstanceID = instance.materialIndex,
+            .bottomAccelStruct = rdBotASList[instance.meshIndex]
+        };
+        rdInstanceList.push_back(inst);
+    }
+
+    RD::TopAccelStruct rdTopAS = RD::BuildAccelStruct(plt, rdInstanceList);
+
+    time(&end_t);
+    diff_t = difftime(end_t, start_t);
+    printf("\nBVH build report:\n");
+    printf("\tNumber of meshes: %lu\n", host.meshInfoList.size());
+    printf("\tNumber of vertices: %lu\n", host.vertexList.size());
+    printf("\tNumber of triangles: %lu\n", host.indexList.size());
+    printf("\tBuild threads: %u\n", ThreadPool::Get()->ThreadCount());
+    printf("\tBuild time cost: %f (sec)\n", diff_t);
+
+    return rdTopAS;
+}
+
+RD::TopAccelStruct Scene::BuildAccelStruct(SceneHostData& host, RD::Platform* plt)
+{
+    std::vector<std::future<RD::BottomAccelStruct>> bottomAccelStructs =
+        BuildBottomAccelStructs(host, plt);
+    return BuildTopAccelStruct(host, plt, bottomAccelStructs);
+}
+
+bool Scene::Cook(SceneHostData& host, RD::Platform* plt, std::string path,
+    std::string sourcePath)
+{
+    struct stat sourceStat;
+    if (stat(sourcePath.c_str(), &sourceStat) != 0)
+    {
+        printf("Failed to stat %s\n", sourcePath.c_str());
+        return false;
+    }
+
+    // Joins the bottom level builds, so the attributes below are packed in leaf order
+    RD::TopAccelStruct rdTopAS = BuildAccelStruct(host, plt);
+    std::vector<char> accelStructData;
+    RD::ReadTopAccelStruct(plt, rdTopAS, accelStructData);
+
+    std::vector<RD::MeshInfo> meshInfoList;
+    RD::AttributeStreams attributes;
+    PackAttributes(host, meshInfoList, attributes);
+
+    const std::pair<const void*, size_t> sections[COOKED_SECTION_COUNT] = {
+        {meshInfoList.data(),      meshInfoList.size()      * sizeof(RD::MeshInfo)},
+        {host.vertexList.data(),   host.vertexList.size()   * sizeof(RD::Vec3)},
+        {attributes.indexData.data(),  attributes.indexData.size()  * sizeof(uint32_t)},
+        {attributes.uvData.data(),     attributes.uvData.size()     * sizeof(uint32_t)},
+        {attributes.normalData.data(), attributes.normalData.size() * sizeof(uint32_t)},
+        {host.matList.data(),      host.matList.size()      * sizeof(RD::Material)},
+        {host.textureInfoList.data(), host.textureInfoList.size() * sizeof(RD::TextureInfo)},
+        {host.textureData.data(),  host.textureData.size()},
+        {accelStructData.data(),   accelStructData.size()}
+    };
+
+    CookedSceneHeader header = {};
+    header.magic           = COOKED_SCENE_MAGIC;
+    header.version         = COOKED_SCENE_VERSION;
+    header.meshInfoSize    = sizeof(RD::MeshInfo);
+    header.materialSize    = sizeof(RD::Material);
+    header.textureInfoSize = sizeof(RD::TextureInfo);
+    header.textureCount    = host.textureInfoList.size();
+    header.hasTextures     = host.hasTextures;
+    header.hasTransmission = host.hasTransmission;
+    header.sourceSize      = sourceStat.st_size;
+    header.sourceMtime     = sourceStat.st_mtime;
+
+    uint64_t offset = sizeof(CookedSceneHeader);
+    for (int i = 0; i < COOKED_SECTION_COUNT; i++)
+    {
+        offset = (offset + COOKED_SCENE_ALIGN - 1) & ~(uint64_t)(COOKED_SCENE_ALIGN - 1);
+        header.sections[i] = {offset, sections[i].second};
+        offset += sections[i].second;
+    }
+
+    // Written next to the target and renamed, readers never see a partial file
+    std::string tmpPath = path + ".tmp";
+    FILE* fp = fopen(tmpPath.c_str(), "wb");
+    if (fp == nullptr)
+    {
+        printf("Failed to open %s for writing\n", tmpPath.c_str());
+        return false;
+    }
+
+    bool ok = fwrite(&header, sizeof(header), 1, fp) == 1;
+    for (int i = 0; ok && i < COOKED_SECTION_COUNT; i++)
+    {
+        ok = fseek(fp, header.sections[i].offset, SEEK_SET) == 0 &&
+            fwrite(sections[i].first, 1, sections[i].second, fp) == sections[i].second;
+    }
+
+    // Pad the last section so the file size matches the section table
+    if (ok && offset > 0)
+        ok = fseek(fp, offset - 1, SEEK_SET) == 0 && fputc(0, fp) != EOF &&
+            fflush(fp) == 0;
+    ok = fclose(fp) == 0 && ok;
+
+    if (!ok || rename(tmpPath.c_str(), path.c_str()) != 0)
+    {
+        printf("Failed to write cooked scene %s\n", path.c_str());
+        remove(tmpPath.c_str());
+        return false;
+    }
+
+    printf("Cooked scene %s: %lu bytes\n", path.c_str(), offset);
+    return true;
+}
+
+Scene* Scene::LoadCooked(std::string path, std::string sourcePath, RD::Platform* plt,
+    size_t textureBudget)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return nullptr;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(CookedSceneHeader))
+    {
+        close(fd);
+        return nullptr;
+    }
+
+    void* mapping = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED)
+        return nullptr;
+
+    const char* base = (const char*)mapping;
+    const CookedSceneHeader* header = (const CookedSceneHeader*)base;
+
+    bool valid = header->magic == COOKED_SCENE_MAGIC &&
+        header->version == COOKED_SCENE_VERSION &&
+        header->meshInfoSize == sizeof(RD::MeshInfo) &&
+        header->materialSize == sizeof(RD::Material) &&
+        header->textureInfoSize == sizeof(RD::TextureInfo) &&
+        header->sections[COOKED_TEXTURE_INFO].size ==
+            (uint64_t)header->textureCount * sizeof(RD::TextureInfo);
+
+    for (int i = 0; valid && i < COOKED_SECTION_COUNT; i++)
+    {
+        const CookedSectionDesc& section = header->sections[i];
+        valid = section.offset <= (uint64_t)st.st_size &&
+            section.size <= (uint64_t)st.st_size - section.offset;
+    }
+
+    if (!valid)
+    {
+        printf("Stale or corrupt cooked scene %s, cook it again\n", path.c_str());
+        munmap(mapping, st.st_size);
+        return nullptr;
+    }
+
+    // Without the model there is nothing newer to load, the cooked scene is used as is
+    struct stat sourceStat;
+    if (stat(sourcePath.c_str(), &sourceStat) == 0 &&
+        ((uint64_t)sourceStat.st_size != header->sourceSize ||
+         (int64_t)sourceStat.st_mtime != header->sourceMtime))
+    {
+        printf("Cooked scene %s is older than %s, cook it again\n",
+            path.c_str(), sourcePath.c_str());
+        munmap(mapping, st.st_size);
+        return nullptr;
+    }
+
+    // Sections are read once front to back
+    madvise(mapping, st.st_size, MADV_SEQUENTIAL);
+
+    RD::UploadManager uploader = RD::CreateUploadManager(plt);
+    RD::MemoryFlags memFlags = RD::HasUnifiedMemory(plt) ? RD_MEMORY_HOST_ALLOC : RD_MEMORY_DEVICE;
+
+    // Empty texture sections still get a minimal buffer to bind
+    auto uploadSection = [&](CookedSection index, RD::MemoryFlags flags) {
+        const CookedSectionDesc& section = header->sections[index];
+        RD::Buffer buffer = RD::CreateBuffer(plt, std::max(section.size, (uint64_t)64), flags);
+        if (section.size > 0)
+            RD::UploadBuffer(uploader, buffer, section.size, base + section.offset);
+        return buffer;
+    };
+
+    RD::Scene* rdScene = new RD::Scene();
+    rdScene->meshInfoData   = uploadSection(COOKED_MESH_INFO, memFlags);
+    rdScene->vertexData     = uploadSection(COOKED_VERTEX, memFlags);
+    rdScene->indexData      = uploadSection(COOKED_INDEX, memFlags);
+    rdScene->uvData         = uploadSection(COOKED_UV, memFlags);
+    rdScene->normalData     = uploadSection(COOKED_NORMAL, memFlags);
+    rdScene->materialData   = uploadSection(COOKED_MATERIAL, memFlags);
+    rdScene->textureInfoData = uploadSection(COOKED_TEXTURE_INFO, memFlags);
+    rdScene->topAccelStruct = uploadSection(COOKED_ACCEL_STRUCT, RD_MEMORY_DEVICE);
+
+    const CookedSectionDesc& textureSection = header->sections[COOKED_TEXTURE];
+    bool virtualTextures = textureBudget > 0 && textureSection.size > textureBudget;
+    if (virtualTextures)
+    {
+        // Pages are read from the mapping as they are requested, in any order
+        const char* textureData = base + textureSection.offset;
+        uint64_t page = sysconf(_SC_PAGESIZE);
+        uint64_t adviseStart = textureSection.offset & ~(page - 1);
+        madvise((void*)(base + adviseStart),
+            textureSection.offset + textureSection.size - adviseStart, MADV_RANDOM);
+
+        const RD::TextureInfo* infos = (const RD::TextureInfo*)
+            (base + header->sections[COOKED_TEXTURE_INFO].offset);
+        rdScene->virtualTexture = RD::CreateVirtualTexture(plt,
+            std::vector<RD::TextureInfo>(infos, infos + header->textureCount),
+            textureData, textureSection.size, textureBudget);
+        rdScene->textureData      = RD::VirtualTexturePool(rdScene->virtualTexture);
+        rdScene->texturePageTable = RD::VirtualTexturePageTable(rdScene->virtualTexture);
+        rdScene->textureFeedback  = RD::VirtualTextureFeedback(rdScene->virtualTexture);
+        rdScene->cookedMapping    = mapping;
+        rdScene->cookedSize       = st.st_size;
+    }
+    else
+    {
+        rdScene->textureData      = uploadSection(COOKED_TEXTURE, memFlags);
+        rdScene->texturePageTable = RD::CreateBuffer(plt, sizeof(uint32_t));
+        rdScene->textureFeedback  = RD::CreateBuffer(plt, sizeof(uint32_t));
+    }
+
+    rdScene->hasTextures     = header->hasTextures;
+    rdScene->hasTransmission = header->hasTransmission;
+
+    // Sync point: the mapping is the upload source until every transfer is done
+    RD::DestroyUploadManager(uploader);
+    if (!virtualTextures)
+        munmap(mapping, st.st_size);
 
     return rdScene;
 }
 
-void Scene::BuildInstance(aiNode* node, std::vector<RD::Instance>& rdInstanceList,
-    const RD::Mat4x4& parentTF,const aiScene* scene,
-    const std::vector<RD::BottomAccelStruct>& rdBotASList)
+Scene::~Scene()
+{
+    if (virtualTexture)
+        RD::DestroyVirtualTexture(virtualTexture);
+    if (cookedMapping)
+        munmap(cookedMapping, cookedSize);
+}
+
+unsigned int Scene::StreamTextures()
+{
+    if (virtualTexture == nullptr)
+        return 0;
+    return RD::UpdateVirtualTexture(virtualTexture);
+}
+
+void Scene::BuildInstance(aiNode* node, std::vector<SceneInstance>& instanceList,
+    const RD::Mat4x4& parentTF, const aiScene* scene)
 {
     if (node == nullptr) return;
 
@@ -297,20 +867,19 @@ void Scene::BuildInstance(aiNode* node, std::vector<RD::Instance>& rdInstanceLis
         unsigned int meshIdx = node->mMeshes[i];
         const aiMesh* mesh = scene->mMeshes[meshIdx];
 
-        RD::Instance inst = {
+        SceneInstance inst = {
             .transform = currentTF,
-            .SBTOffset = 0,
-            .customInstanceID = mesh->mMaterialIndex,
-            .bottomAccelStruct = rdBotASList[meshIdx]
+            .meshIndex = meshIdx,
+            .materialIndex = mesh->mMaterialIndex
         };
 
-        rdInstanceList.push_back(inst);
+        instanceList.push_back(inst);
     }
 
     for (int i = 0; i < node->mNumChildren; i++)
     {
-        BuildInstance(node->mChildren[i], rdInstanceList,
-            currentTF, scene, rdBotASList);
+        BuildInstance(node->mChildren[i], instanceList,
+            currentTF, scene);
     }
 }
 
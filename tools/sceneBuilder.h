@@ -2,6 +2,7 @@
 
 #include <string>
 #include <vector>
+#include <future>
 
 #include <radiance.h>
 
@@ -12,8 +13,10 @@ scene->indexData,                   \
 scene->uvData,                      \
 scene->normalData,                  \
 scene->materialData,                \
+scene->textureInfoData,             \
 scene->textureData,                 \
-scene->sampler,                     \
+scene->texturePageTable,            \
+scene->textureFeedback,             \
 scene->topAccelStruct 
 
 #define INCLUDE_SCENE_LAYOUT        \
@@ -23,19 +26,112 @@ RD::BUFFER_TYPE,                    \
 RD::BUFFER_TYPE,                    \
 RD::BUFFER_TYPE,                    \
 RD::BUFFER_TYPE,                    \
-RD::TEX_ARRAY_TYPE,                 \
-RD::IMAGE_SAMPLER_TYPE,             \
+RD::BUFFER_TYPE,                    \
+RD::BUFFER_TYPE,                    \
+RD::BUFFER_TYPE,                    \
+RD::BUFFER_TYPE,                    \
 RD::ACCEL_STRUCT_TYPE
 
 
+#define COMPRESS_TEXTURES 1 // Block compress textures by material usage, see AppendTextures()
+#define COOKED_SCENE_EXTENSION ".rdscene" // sceneCooker writes <model><ext> by default
+
+
 namespace RD
 {
 
+// Mesh placed in the scene, resolved to a bottom level AS when the top level AS is built
+struct SceneInstance
+{
+    RD::Mat4x4 transform;
+    unsigned int meshIndex;
+    unsigned int materialIndex;
+};
+
+// Scene as imported on the host, before anything is uploaded to the device
+struct SceneHostData
+{
+    std::vector<RD::MeshInfo>   meshInfoList;
+    std::vector<RD::Vec3>       vertexList;
+    std::vector<RD::Triangle>   indexList;
+    std::vector<RD::Vec3>       uvList;
+    std::vector<RD::Vec3>       normalList;
+    std::vector<RD::Material>   matList;
+
+    // Texture table, every texture at native size with its mip chain (RD::AppendTexture())
+    std::vector<RD::TextureInfo> textureInfoList;
+    std::vector<unsigned char>   textureData;
+    unsigned int textureLayout = TEXTURE_LAYOUT_LINEAR; // set before importing, see RD::PreferredTextureLayout()
+
+    // Element counts per mesh, ranges start at MeshInfo offsets / 3
+    std::vector<unsigned int> meshVertexCount;
+    std::vector<unsigned int> meshTriangleCount;
+    std::vector<SceneInstance> instanceList;
+
+    // Material features, used to specialize shaders
+    bool hasTextures = false;
+    bool hasTransmission = false;
+
+    // Permute every mesh to the leaf order of its bottom level AS once it is built,
+    // see RD::ReorderAccelStructMesh(). Off by default, it delays the upload until
+    // the bottom level builds are done.
+    bool leafOrder = false;
+};
+
+// Decoded texture, level 0 first then its mips (RD::BuildMipChain())
+struct TextureLevels
+{
+    unsigned int width = 0;
+    unsigned int height = 0;
+    std::vector<unsigned char> levels;
+
+    RD::AddressingMode addressMode = RD_ADDRESS_REPEAT;
+    RD::FilterMode filterMode = RD_FILTER_LINEAR;
+};
+
+// Decodes an encoded image (png, jpg, ...) to RGBA8 and builds its mips, thread safe
+bool DecodeTexture(const unsigned char* encoded, size_t size, TextureLevels& texture);
+// Packs decoded textures into the texture table, in order so material indices stay valid.
+// Needs host.matList: albedo maps become BC1, normal maps BC5 with z rebuilt,
+// metallic/roughness maps BC4/BC5 with only the channels the shader reads.
+// Fails when the packed table passes the 4 GB the 32-bit texel offsets address.
+bool AppendTextures(SceneHostData& host, const std::vector<TextureLevels>& textures);
+// Packs the shading attributes of every mesh for the device (RD::AppendMeshAttributes()),
+// meshInfoList is host.meshInfoList with the offsets and formats of the packed streams.
+// Needs the texture table: UVs stay within half a texel of the largest texture of the mesh.
+void PackAttributes(const SceneHostData& host, std::vector<RD::MeshInfo>& meshInfoList,
+    RD::AttributeStreams& streams);
+
 struct Scene
 {
 public:
     static Scene* Load(std::string path, RD::Platform* plt, bool loadFromCache = false);
 
+    // .glb files take the native loader (gltfLoader.h), anything else or
+    // anything it does not handle goes through Assimp. Textures are decoded and mipmapped.
+    static bool Import(std::string path, SceneHostData& host);
+    // Creates the scene buffers, the top level AS is left to the caller
+    static Scene* Upload(const SceneHostData& host, RD::Platform* plt);
+    static RD::TopAccelStruct BuildAccelStruct(SceneHostData& host, RD::Platform* plt);
+
+    // Cooked scenes hold every section ready to upload, see cookedScene.h.
+    // sourcePath is the model the host data was imported from.
+    static bool Cook(SceneHostData& host, RD::Platform* plt, std::string path,
+        std::string sourcePath);
+    // Returns null when the file is missing, stale or was cooked from another version
+    // of sourcePath, the model is not required to exist.
+    // Textures over textureBudget bytes (0: no limit) stay in the mapped file and
+    // are paged in on demand, see RD::CreateVirtualTexture() and StreamTextures()
+    static Scene* LoadCooked(std::string path, std::string sourcePath, RD::Platform* plt,
+        size_t textureBudget = 0);
+
+    // Streams the texture pages the last trace batch missed, call between batches.
+    // Returns the number of pages loaded, always 0 without virtual textures.
+    unsigned int StreamTextures();
+
+    // Destroys the virtual texture and unmaps the cooked file it pages from
+    ~Scene();
+
     RD::Buffer meshInfoData;
     RD::Buffer vertexData;
     RD::Buffer indexData;
@@ -43,15 +139,35 @@ public:
     RD::Buffer normalData;
 
     RD::Buffer materialData;
-    RD::ImageArray textureData;
-    RD::Sampler sampler;
+    RD::Buffer textureInfoData; // RD::TextureInfo per texture
+    RD::Buffer textureData;     // texels of every level, see shader/texture.cl
+    RD::Buffer texturePageTable; // placeholders unless the textures are virtual
+    RD::Buffer textureFeedback;
+
+    // Virtual textures page from the cooked file, kept mapped for them
+    RD::VirtualTexture virtualTexture = nullptr;
+    void* cookedMapping = nullptr;
+    size_t cookedSize = 0;
 
     RD::TopAccelStruct topAccelStruct;
 
+    // Material features, used to specialize shaders
+    bool hasTextures;
+    bool hasTransmission;
+
 private:
-    static void BuildInstance(aiNode* node, std::vector<RD::Instance>& rdInstanceList,
-        const RD::Mat4x4& parentTF,const aiScene* scene,
-        const std::vector<RD::BottomAccelStruct>& rdBotASList);
+    static bool ImportAssimp(std::string path, SceneHostData& host);
+
+    // One task per mesh on the shared ThreadPool, reading the host ranges in place.
+    // With host.leafOrder the tasks also permute their ranges, nothing else may read them
+    // before the builds are joined.
+    static std::vector<std::future<RD::BottomAccelStruct>> BuildBottomAccelStructs(
+        SceneHostData& host, RD::Platform* plt);
+    // Joins the bottom level builds, the host data must outlive them
+    static RD::TopAccelStruct BuildTopAccelStruct(const SceneHostData& host, RD::Platform* plt,
+        std::vector<std::future<RD::BottomAccelStruct>>& bottomAccelStructs);
+    static void BuildInstance(aiNode* node, std::vector<SceneInstance>& instanceList,
+        const RD::Mat4x4& parentTF, const aiScene* scene);
 };
 
-} // namespace RD
\ No newline at end of file
+} // namespace RD
@@ -0,0 +1,31 @@
+#include "sceneBuilder.h"
+
+#include <cstdio>
+
+// Imports a scene once and writes everything the renderer uploads into one cooked file.
+// Usage: sceneCooker <model> [output], output defaults to <model>.rdscene
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        printf("Usage: %s <model> [output]\n", argv[0]);
+        return 1;
+    }
+
+    std::string modelFile = argv[1];
+    std::string outputFile = argc > 2 ? argv[2] : modelFile + COOKED_SCENE_EXTENSION;
+
+    // Textures are laid out for the device the cooked scene is made on
+    RD::Platform* plt = RD::Platform::GetPlatform();
+    RD::SceneHostData host;
+    host.textureLayout = RD::PreferredTextureLayout(plt);
+    host.leafOrder = true; // cooking is offline, nothing overlaps the bottom level builds
+    if (!RD::Scene::Import(modelFile, host))
+        return 1;
+
+    // The top level AS is assembled in a device buffer and read back
+    if (!RD::Scene::Cook(host, plt, outputFile, modelFile))
+        return 1;
+
+    return 0;
+}
@@ -0,0 +1,90 @@
+#include "threadPool.h"
+
+#include <atomic>
+#include <algorithm>
+
+namespace RD
+{
+
+ThreadPool* ThreadPool::Get()
+{
+    static ThreadPool pool(std::max(1u, std::thread::hardware_concurrency()));
+    return &pool;
+}
+
+ThreadPool::ThreadPool(unsigned int threadCount)
+{
+    for (unsigned int i = 0; i < threadCount; i++)
+        threads.emplace_back(&ThreadPool::Worker, this);
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wakeup.notify_all();
+
+    for (std::thread& thread: threads)
+        thread.join();
+}
+
+void ThreadPool::Worker()
+{
+    while (true)
+    {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wakeup.wait(lock, [this]() { return stopping || !tasks.empty(); });
+            if (tasks.empty())
+                return;
+            task = std::move(tasks.front());
+            tasks.pop_front();
+        }
+        task();
+    }
+}
+
+void ThreadPool::ParallelFor(size_t count, const std::function<void(size_t)>& body)
+{
+    // Shared with the helpers, which may only get to run after the caller returned
+    struct Range
+    {
+        std::atomic<size_t> next{0};
+        std::atomic<size_t> done{0};
+        size_t count;
+        std::function<void(size_t)> body;
+        std::mutex mutex;
+        std::condition_variable finished;
+    };
+
+    auto range = std::make_shared<Range>();
+    range->count = count;
+    range->body = body;
+
+    auto run = [range]() {
+        for (size_t i = range->next++; i < range->count; i = range->next++)
+        {
+            range->body(i);
+            if (++range->done == range->count)
+            {
+                std::lock_guard<std::mutex> lock(range->mutex);
+                range->finished.notify_all();
+            }
+        }
+    };
+
+    // Only the indices are waited on, never the helpers: a helper queued behind
+    // busy workers would otherwise deadlock a caller that is itself a task
+    size_t helperCount = std::min<size_t>(threads.size(), count > 0 ? count - 1 : 0);
+    for (size_t i = 0; i < helperCount; i++)
+        Submit(run);
+
+    run();
+    std::unique_lock<std::mutex> lock(range->mutex);
+    range->finished.wait(lock, [&]() { return range->done == count; });
+}
+
+} // namespace RD
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <deque>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <future>
+#include <functional>
+#include <condition_variable>
+
+namespace RD
+{
+
+// Fixed set of worker threads running queued tasks in submission order
+struct ThreadPool
+{
+public:
+    // Shared pool with one worker per hardware thread
+    static ThreadPool* Get();
+
+    explicit ThreadPool(unsigned int threadCount);
+    ~ThreadPool(); // finishes queued tasks, then joins
+
+    template <typename Task>
+    auto Submit(Task&& task) -> std::future<decltype(task())>
+    {
+        typedef decltype(task()) Result;
+        auto packaged = std::make_shared<std::packaged_task<Result()>>(std::forward<Task>(task));
+        std::future<Result> result = packaged->get_future();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            tasks.push_back([packaged]() { (*packaged)(); });
+        }
+        wakeup.notify_one();
+        return result;
+    }
+
+    // Runs body(0) .. body(count - 1) on the workers and the calling thread.
+    // The caller always makes progress, so it is safe to call from a task.
+    void ParallelFor(size_t count, const std::function<void(size_t)>& body);
+
+    unsigned int ThreadCount() const { return threads.size(); }
+
+private:
+    void Worker();
+
+    std::vector<std::thread> threads;
+    std::deque<std::function<void()>> tasks;
+    std::mutex mutex;
+    std::condition_variable wakeup;
+    bool stopping = false;
+};
+
+} // namespace RD